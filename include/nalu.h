@@ -0,0 +1,29 @@
+#ifndef FFMPEG_DEMO_NALU_H
+#define FFMPEG_DEMO_NALU_H
+
+/**
+ * H.264 NALU头中的nal_unit_type和nal_reference_idc
+ * */
+typedef enum {
+	NALU_TYPE_SLICE    = 1,
+	NALU_TYPE_DPA      = 2,
+	NALU_TYPE_DPB      = 3,
+	NALU_TYPE_DPC      = 4,
+	NALU_TYPE_IDR      = 5,
+	NALU_TYPE_SEI      = 6,
+	NALU_TYPE_SPS      = 7,
+	NALU_TYPE_PPS      = 8,
+	NALU_TYPE_AUD      = 9,
+	NALU_TYPE_EOSEQ    = 10,
+	NALU_TYPE_EOSTREAM = 11,
+	NALU_TYPE_FILL     = 12,
+} NaluType;
+ 
+typedef enum {
+	NALU_PRIORITY_DISPOSABLE = 0,
+	NALU_PRIRITY_LOW         = 1,
+	NALU_PRIORITY_HIGH       = 2,
+	NALU_PRIORITY_HIGHEST    = 3
+} NaluPriority;
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _AUDIO_RING_H
+#define _AUDIO_RING_H
+
+extern "C"
+{
+#include <libavutil/common.h>
+#include <SDL2/SDL.h>
+#include "util.h"
+}
+#include <atomic>
+#include "QueueStats.h"
+
+/**
+ * 单生产者(音频解码线程)单消费者(SDL音频回调)的无锁PCM环形缓冲区。
+ * rpos/wpos是累计读写的字节数，只由各自的一方修改；回调中不加锁也不等待，数据不足时由调用者补静音
+ * */
+class AudioRing
+{
+private:
+    uint8_t *buf = NULL;
+    int capacity = 0;       //buf的字节数
+    int frame_size = 1;     //一个采样点(所有声道)的字节数，读取总是按采样点对齐
+    int bytes_per_sec = 0;
+    std::atomic<int64_t> rpos{0};       //只由消费者修改
+    std::atomic<int64_t> wpos{0};       //只由生产者修改
+    std::atomic<int64_t> flush_pos{0};  //生产者请求丢弃该位置之前的数据，由消费者在读取时执行
+
+    //时钟锚点：字节位置anchor_pos处数据的pts，由生产者设置，通过anchor_seq做一致性快照
+    std::atomic<unsigned> anchor_seq{0};
+    std::atomic<int64_t> anchor_pos{0};
+    std::atomic<double> anchor_pts{NAN};
+    std::atomic<int> anchor_serial{-1};
+
+    //统计数据
+    std::atomic<int64_t> max_fill{0};
+    std::atomic<int64_t> producer_waits{0};
+    std::atomic<int64_t> producer_wait_us{0};
+    std::atomic<int64_t> underruns{0}; //回调读取到的数据不足的次数，包括文件结束之后
+
+    void copy_in(int64_t pos, const uint8_t *data, int len);
+    void copy_out(int64_t pos, uint8_t *dst, int len);
+
+public:
+    AudioRing();
+    /**
+     * capacity为缓冲区的字节数，按frame_size向下对齐
+     * */
+    int init(int capacity, int frame_size, int bytes_per_sec);
+    /**
+     * 生产者调用，写入不超过剩余空间的数据，返回实际写入的字节数
+     * */
+    int write(const uint8_t *data, int len);
+    /**
+     * 生产者调用，空间不足以写入len字节时，按消费速度估算需要的时间休眠，最多max_wait_ms
+     * */
+    void wait_space(int len, int max_wait_ms);
+    /**
+     * 消费者调用，不加锁不等待，返回实际读取的字节数
+     * */
+    int read(uint8_t *dst, int len);
+    /**
+     * 生产者调用，标记接下来写入的数据的pts(秒)
+     * */
+    void set_clock_anchor(double pts, int serial);
+    /**
+     * 消费者调用，下一个要读取的字节的pts，还没有设置过锚点时返回0
+     * */
+    int read_clock(double *pts, int *serial);
+    /**
+     * 生产者调用，丢弃目前为止写入的所有数据(seek之后)
+     * */
+    void flush();
+    /**
+     * 缓冲区中还没有播放的字节数
+     * */
+    int fill();
+    int get_bytes_per_sec();
+    void stats(QueueStats *stats);
+    void destory();
+    ~AudioRing();
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+extern "C"
+{
+#include <libavutil/time.h>
+#include <libavutil/common.h>
+}
+#include <atomic>
+#include "PacketQueue.h"
+
+#define AV_NOSYNC_THRESHOLD 10.0 //时钟相差超过这个值(秒)就不再同步
+
+/**
+ * 播放时钟：记录最近一次设置的pts和当时的系统时间，读取时按速度外推。
+ * 每个时钟只有一个线程写入(音频时钟在SDL回调中，视频和外部时钟在刷新线程中)，
+ * 读取通过seq做无锁的一致性快照，可以在任意线程调用
+ * */
+class Clock
+{
+private:
+    std::atomic<unsigned> seq{0};          //奇数表示正在写入
+    std::atomic<double> pts{NAN};          //clock base
+    std::atomic<double> pts_drift{NAN};    //clock base minus time at which we updated the clock
+    std::atomic<double> last_updated{0};
+    std::atomic<double> speed{1.0};
+    std::atomic<int> serial{-1};           //clock is based on a packet with this serial
+    PacketQueue *queue = NULL;             //serial与queue不一致时时钟已过期，NULL表示时钟不依赖于队列
+
+    void store(double pts, int serial, double time, double speed);
+    void snapshot(double *pts, double *pts_drift, double *last_updated, double *speed, int *serial);
+
+public:
+    Clock();
+    void init(PacketQueue *queue);
+    /**
+     * 当前时钟的值(秒)，时钟已过期或者还没有设置时返回NAN
+     * */
+    double get();
+    /**
+     * time为av_gettime_relative的时间(秒)
+     * */
+    void set_at(double pts, int serial, double time);
+    void set(double pts, int serial);
+    void set_speed(double speed);
+    double get_speed();
+    int get_serial();
+    double get_last_updated();
+    /**
+     * 时钟无效或者与slave相差太多时，与slave对齐
+     * */
+    void sync_to_slave(Clock *slave);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _DECODE_SKIP_POLICY_H
+#define _DECODE_SKIP_POLICY_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include "util.h"
+}
+#include <atomic>
+#include "QueueStats.h"
+
+#define DECODE_SKIP_MAX_LEVEL 5
+#define DECODE_SKIP_ESCALATE_FRAMES 8 //连续这么多帧落后时提高一级
+#define DECODE_SKIP_RELAX_FRAMES 120  //连续这么多帧按时解码时降低一级
+
+/**
+ * 解码负载过高时逐级降低解码质量，追上之后再逐级恢复：
+ * 1 跳过非参考帧的环路滤波，2 跳过所有环路滤波，3 再跳过非参考帧的IDCT，
+ * 4 再跳过非参考帧，5 只解码关键帧。
+ * update只能在解码线程中调用，级别可以在任意线程读取
+ * */
+class DecodeSkipPolicy
+{
+private:
+    int max_level = DECODE_SKIP_MAX_LEVEL;
+    int late_frames = 0;   //连续落后的帧数
+    int ontime_frames = 0; //连续按时解码的帧数
+    std::atomic<int> level{0};
+    std::atomic<int> min_level{0}; //外部要求的最低级别，比如倍速播放时只解码关键帧
+    std::atomic<int> max_level_seen{0};
+    std::atomic<int64_t> changes{0};
+
+public:
+    DecodeSkipPolicy();
+    /**
+     * max_level为允许的最高级别，0表示不降级
+     * */
+    void init(int max_level);
+    /**
+     * 每解码一帧调用一次。lateness为frame落后于主时钟的时间(秒)，负数表示提前，
+     * queue_starved表示显示队列已经没有frame了。级别改变时返回1
+     * */
+    int update(double lateness, double frame_interval, int queue_starved);
+    /**
+     * 设置最低级别，不受负载调整的影响。在解码线程下一次apply时生效
+     * */
+    void set_min_level(int min_level);
+    /**
+     * 按当前级别设置avctx的skip_loop_filter/skip_idct/skip_frame
+     * */
+    void apply(AVCodecContext *avctx);
+    int get_level();
+    int get_max_level_seen();
+    int64_t get_changes();
+    static const char *level_name(int level);
+};
+
+#endif
@@ -5,9 +5,12 @@ extern "C"
 {
 #include <libavformat/avformat.h>
 #include "util.h"
+}
 #include "PacketQueue.h"
 #include "FrameQueue.h"
-}
+#include "DecodeSkipPolicy.h"
+
+#define DECODER_PACKET_BATCH 8
 
 class Decoder
 {
@@ -17,13 +20,22 @@ private:
     FrameQueue * frame_queue;
     AVCodecContext *avctx;
     int packet_pending = 0; //avctx中是否还有frame剩余，如有则不需要从pkt_queue中读取
-    int finished = 0;
+    std::atomic<int> finished{0}; //解码器已经输出了所有的frame
+    int pkt_serial = -1; //当前送入解码器的packet的serial
     SDL_cond *empty_queue_cond;
     int64_t start_pts;
     AVRational start_pts_tb;
     int64_t next_pts;
     AVRational next_pts_tb;
     SDL_Thread *decoder_tid;
+    //从pkt_queue中一次取出的一批packet，依次送入解码器
+    MyAVPacketList *pending_nodes[DECODER_PACKET_BATCH];
+    int nb_pending_nodes = 0;
+    int pending_node_index = 0;
+    int64_t wait_us = 0; //最近一次decode_frame中等待packet的时间(微秒)
+    DecodeSkipPolicy *skip_policy = NULL; //负载过高时的降级策略，不属于Decoder
+
+    void release_pending_nodes();
 
 public:
     Decoder(/* args */);
@@ -38,6 +50,23 @@ public:
     void abort();
     void destory();
     int decode_frame(AVFrame *frame);
+    /**
+     * 最近解码出的frame对应的serial
+     * */
+    int get_pkt_serial();
+    int is_finished();
+    /**
+     * 最近一次decode_frame中阻塞在packet queue上等待的时间(微秒)，只能在解码线程中调用
+     * */
+    int64_t get_wait_us();
+    /**
+     * 安装降级策略，NULL表示不降级
+     * */
+    void set_skip_policy(DecodeSkipPolicy *policy);
+    /**
+     * 解码线程每得到一帧调用一次，参数含义同DecodeSkipPolicy::update，级别改变时更新avctx
+     * */
+    void update_skip_policy(double lateness, double frame_interval, int queue_starved);
     ~Decoder();
 };
 
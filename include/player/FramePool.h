@@ -0,0 +1,56 @@
+#ifndef _FRAME_POOL_H
+#define _FRAME_POOL_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <SDL2/SDL.h>
+#include "util.h"
+}
+#include <atomic>
+
+#define FRAME_POOL_ALIGN 64
+
+/**
+ * 解码器的帧缓存池，作为AVCodecContext::get_buffer2使用。
+ * 每个plane一个AVBufferPool，缓存按64字节对齐并循环使用，分辨率或像素格式变化时重建
+ * */
+class FramePool
+{
+private:
+    AVBufferPool *pools[4] = {NULL};
+    int linesize[4] = {0};
+    int width = 0;
+    int height = 0;
+    int format = AV_PIX_FMT_NONE;
+    SDL_mutex *mutex = NULL; //frame多线程解码时get_buffer2可能在不同的线程中调用
+
+    std::atomic<int64_t> nb_gets{0};
+    std::atomic<int64_t> nb_allocs{0};
+    std::atomic<int64_t> nb_trims{0};
+
+    static AVBufferRef *alloc_aligned(void *opaque, int size);
+    static void free_aligned(void *opaque, uint8_t *data);
+    int rebuild(AVCodecContext *avctx, int width, int height, int format);
+    void release_pools();
+
+public:
+    FramePool();
+    int init();
+    /**
+     * 安装到codec_ctx上，需要在avcodec_open2之前调用。解码器不支持直接渲染时不安装
+     * */
+    void attach(AVCodecContext *codec_ctx, const AVCodec *codec);
+    int get_buffer(AVCodecContext *avctx, AVFrame *frame, int flags);
+    /**
+     * 丢弃目前缓存的所有buffer，下一次get_buffer时重建。
+     * AVBufferPool不会释放归还的buffer，frame queue的深度减小后由解码线程调用，释放多余的内存
+     * */
+    void trim();
+    static int get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags);
+    void destory();
+    ~FramePool();
+};
+
+#endif
@@ -1,13 +1,14 @@
 #ifndef _FRAME_QUEUE_H
 #define _FRAME_QUEUE_H
 
-#define VIDEO_PICTURE_QUEUE_SIZE 3
+#define FRAME_QUEUE_MAX_SIZE 16
+#define FRAME_QUEUE_SHRINK_FRAMES 120 //连续这么多帧解码都很稳定时，自适应模式减小一次队列深度
 
 extern "C"
 {
 #include <libavformat/avformat.h>
-#include "PacketQueue.h"
 }
+#include "PacketQueue.h"
 
 class Frame
 {
@@ -16,10 +17,12 @@ public:
     double pts;      /* presentation timestamp for the frame */
     double duration; /* estimated duration of the frame */
     int64_t pos;     /* byte position of the frame in the input file */
+    int serial;      /* 解码该frame的packet的serial */
     int width;
     int height;
     int format;
     int uploaded = 0;
+    int64_t commit_time = 0; //写入队列的时间(av_gettime_relative)，用于统计在队列中等待的时间
     int flip_v;
     AVRational sar; /* 宽高比 */
 
@@ -30,17 +33,20 @@ public:
         return !!frame;
     }
 
-    void copy(Frame *f)
+    /**
+     * frame中已经写入解码后的数据，根据frame设置宽高等属性
+     * */
+    void set_props(double duration, double pts, int64_t pos, int serial)
     {
-        av_frame_move_ref(frame, f->frame);
-        pts = f->pts;
-        duration = f->duration;
-        pos = f->pos;
-        width = f->width;
-        height = f->height;
-        format = f->format;
-        sar = f->sar;
-        uploaded = f->uploaded;
+        this->width = frame->width;
+        this->height = frame->height;
+        this->format = frame->format;
+        this->sar = frame->sample_aspect_ratio;
+        this->duration = duration;
+        this->pts = pts;
+        this->pos = pos;
+        this->serial = serial;
+        this->uploaded = 0;
     }
 
     ~Frame()
@@ -50,23 +56,68 @@ public:
     }
 };
 
+/**
+ * 单生产者(解码线程)单消费者(显示)的无锁环形队列。
+ * rindex只由消费者修改，windex只由生产者修改，双方通过原子的size同步，
+ * mutex和cond只在队列为空或已满需要等待时使用
+ * */
 class FrameQueue
 {
 private:
     Frame *frames;    //数组
-    int rindex;       //正在读取的index
-    int windex;       //正在写入的位置index
-    int size;         //frames中可读取的大小
-    int max_size;     //frames可写入的size
+    int rindex;       //正在读取的index，只由消费者访问
+    int windex;       //正在写入的位置index，只由生产者访问
+    std::atomic<int> size{0}; //frames中可读取的大小
+    int max_size;     //frames数组的大小
+    std::atomic<int> depth{0}; //当前最多可以写入的frame个数，不超过max_size
+    int min_depth = 0;     //自适应模式下深度的范围
+    int max_depth = 0;
+    int steady_frames = 0; //连续解码稳定的帧数，只由生产者访问
     int rindex_shown; //rindex是否已经显示过了，0 or 1
-    SDL_mutex *mutex;
+    SDL_mutex *mutex; //只用于等待
     SDL_cond *cond;
     PacketQueue *pktq;
 
+    //统计数据，供stats()无锁读取
+    std::atomic<int> max_size_seen{0};
+    std::atomic<int64_t> producer_waits{0};
+    std::atomic<int64_t> producer_wait_us{0};
+    std::atomic<int64_t> consumer_waits{0};
+    std::atomic<int64_t> consumer_wait_us{0};
+    std::atomic<int64_t> wakeups{0};
+
+    //唤醒的水位，含义同PacketQueue::set_wakeup_thresholds
+    int consumer_wake_threshold = 1;
+    int producer_wake_space = 1;
+    int wake_max_delay_ms = 10;
+    std::atomic<int> consumer_waiting{0};
+    std::atomic<int> producer_waiting{0};
+
+    /**
+     * ready时唤醒在cond上等待的一方
+     * */
+    void wake(std::atomic<int> &waiting, int ready);
+
 public:
     FrameQueue();
-    int init(uint max_size, PacketQueue *);
+    /**
+     * depth为队列深度，max_depth大于depth时开启自适应深度，深度在[depth, max_depth]之间调整
+     * */
+    int init(int depth, PacketQueue *, int max_depth = 0);
+    /**
+     * 由解码线程调用：解码耗时超过帧间隔时增大队列深度，连续稳定一段时间后减小。
+     * 返回深度的变化：1增大，-1减小，0不变
+     * */
+    int adapt_depth(double decode_time, double frame_interval);
     bool is_empty();
+    /**
+     * 无锁读取队列当前的状态快照
+     * */
+    void stats(QueueStats *stats);
+    /**
+     * 设置唤醒的水位，默认都为1，即每次都唤醒
+     * */
+    void set_wakeup_thresholds(int consumer_wake_threshold, int producer_wake_space, int max_delay_ms);
     void destory();
     /**
      * 返回下一个没有显示过的frame, 不改变index的位置
@@ -77,24 +128,39 @@ public:
      * */
     Frame *peekLast();
     /**
-     * 返回可写入的frame地址空间
+     * 返回peek之后的下一个frame，调用前需要确认nb_remaining() > 1
+     * */
+    Frame *peekNext();
+    /**
+     * 还没有显示过的frame个数，无锁
+     * */
+    int nb_remaining();
+    /**
+     * 预留可写入的frame地址空间，队列已满则等待。
+     * 生产者直接写入返回的frame，然后调用commit发布，不需要中间的frame
      * */
     Frame *peekWritable();
+    /**
+     * 发布peekWritable预留的frame，移动windex并按水位唤醒消费者
+     * */
+    void commit();
     /**
      * 返回可读取的frame地址，不改变index的位置
      * */
     Frame *peekReadable();
     /**
-     * 读取一个没有显示过的frame，改变rindex的位置
-     * 列表为空，则等待
+     * 返回可读取的frame地址，不改变index的位置。
+     * 列表为空时最多等待到deadline(av_gettime_relative的时间，微秒)，deadline已过则不等待
      * */
-    Frame *get();
+    Frame *peek_until(int64_t deadline);
     /**
-     * 将frame写入到可写入的位置，已写满则等待
+     * 释放当前读取位置上的frame，并把位置归还给生产者。用于peek之后，frame使用完毕再释放
      * */
-    Frame *put(Frame *);
-
-    Frame *put(AVFrame *frame, int duration, double pts, int64_t pos);
+    void next();
+    /**
+     * 将frame中的数据移动到可写入的位置，已写满则等待
+     * */
+    Frame *put(AVFrame *frame, double duration, double pts, int64_t pos, int serial);
 
     /**
      * 唤醒cond
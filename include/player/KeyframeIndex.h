@@ -0,0 +1,48 @@
+#ifndef _KEYFRAME_INDEX_H
+#define _KEYFRAME_INDEX_H
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+#include <vector>
+
+/**
+ * 关键帧在文件中的位置，pts为stream的时间基
+ * */
+struct KeyframeEntry
+{
+    int64_t pts = AV_NOPTS_VALUE;
+    int64_t pos = -1;  //packet在文件中的字节位置，-1表示未知
+    int has_next = 0;  //下一个条目就是文件中紧接着的关键帧，两者之间没有其他关键帧
+};
+
+/**
+ * 播放过程中由读取到的视频packet逐步建立的关键帧索引，按pts排序。
+ * 目标时间落在两个连续读取到的关键帧之间时，seek可以直接定位到前一个关键帧，
+ * 不需要demuxer再向前搜索。只在读取线程中访问，不加锁
+ * */
+class KeyframeIndex
+{
+private:
+    std::vector<KeyframeEntry> entries;
+    int64_t last_pts = AV_NOPTS_VALUE; //本次连续读取中上一个关键帧的pts
+
+public:
+    KeyframeIndex();
+    /**
+     * 读取到一个关键帧时调用
+     * */
+    void add(int64_t pts, int64_t pos);
+    /**
+     * 查找pts不大于ts的最近的关键帧，只有确定两者之间没有其他关键帧时才返回1
+     * */
+    int lookup(int64_t ts, KeyframeEntry *entry);
+    /**
+     * seek之后读取的位置不再连续
+     * */
+    void new_run();
+    int size();
+};
+
+#endif
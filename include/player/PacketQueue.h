@@ -8,11 +8,15 @@ extern "C"
 #include <SDL2/SDL.h>
 #include "util.h"
 }
+#include <atomic>
+#include "QueueStats.h"
 
 class MyAVPacketList
 {
 public:
-    AVPacket *pkt;
+    AVPacket *pkt = NULL;
+    MyAVPacketList *next = NULL; //在packet pool的空闲链表中时指向下一个节点
+    int serial = 0;              //写入队列时队列的serial
     MyAVPacketList()
     {
     }
@@ -40,29 +44,148 @@ class PacketQueue
 private:
     /* data */
     AVFifoBuffer *packet_list;
-    int nb_packets;
-    int size = 0;
+    std::atomic<int> nb_packets{0};
+    std::atomic<int> size{0};
 
-    int64_t duration = 0;
-    int abort_request;
+    std::atomic<int64_t> duration{0};
+    std::atomic<int> abort_request{1};
+    std::atomic<int> serial{0}; //每次seek加1，serial不一致的packet和frame都是过期的数据
     SDL_mutex *mutex;
     SDL_cond *cond;
 
+    //单生产者单消费者无锁环形队列，ring_size为0时使用上面的fifo + mutex
+    AVPacket **ring = NULL;
+    int *ring_serials = NULL;
+    unsigned ring_size = 0; //2的幂
+    std::atomic<unsigned> ring_rindex{0};
+    std::atomic<unsigned> ring_windex{0};
+    std::atomic<int> consumer_waiting{0}; //消费者是否在cond上等待（队列为空）
+    std::atomic<int> producer_waiting{0}; //生产者是否在cond上等待（队列已满）
+
+    //packet节点池，get/put复用节点，避免每个packet都new + av_packet_alloc
+    MyAVPacketList *free_list = NULL;
+    SDL_SpinLock pool_lock = 0;
+    std::atomic<int64_t> pool_hits{0};
+    std::atomic<int64_t> pool_misses{0};
+
+    //统计数据，供stats()无锁读取
+    std::atomic<int> max_nb_packets{0};
+    std::atomic<int> max_size{0};
+    std::atomic<int64_t> max_duration_seen{0};
+    std::atomic<int64_t> producer_waits{0};
+    std::atomic<int64_t> producer_wait_us{0};
+    std::atomic<int64_t> consumer_waits{0};
+    std::atomic<int64_t> consumer_wait_us{0};
+    std::atomic<int64_t> wakeups{0};
+
+    //唤醒的水位：积攒到consumer_wake_threshold个packet才唤醒消费者，
+    //空出producer_wake_space个位置(环形队列)才唤醒生产者。被推迟唤醒的一方最多等待wake_max_delay_ms
+    int consumer_wake_threshold = 1;
+    int producer_wake_space = 1;
+    int wake_max_delay_ms = 10;
+
+    //队列上限，0表示不限制。超过上限时读取线程在continue_cond上等待
+    int max_bytes = 0;
+    int64_t max_duration = 0; //以stream的time_base为单位
+    AVRational time_base = {0, 1};
+    SDL_mutex *continue_mutex = NULL;
+    SDL_cond *continue_cond = NULL;
+
+    //过载策略：缓存时长超过latency_budget时先丢弃不被参考的packet，
+    //超过两倍latency_budget时丢弃到下一个关键帧为止
+    double latency_budget = 0; //秒，0表示不丢弃
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    int nal_length_size = 0;   //H.264 avcC格式中NALU长度的字节数，0表示Annex B格式
+    int skip_to_keyframe = 0;  //只由生产者线程读写
+    //packet按写入的顺序编号，put_count只由生产者修改，get_count只由消费者(或者持有mutex的flush)修改。
+    //编号小于drop_before的packet在读取时直接丢弃，丢弃积压的GOP不需要改变serial
+    int64_t put_count = 0;
+    int64_t get_count = 0;
+    std::atomic<int64_t> drop_before{0};
+    std::atomic<int64_t> dropped{0};
+    std::atomic<int64_t> dropped_gops{0};
+
+    int is_disposable(AVPacket *);
+    int overload_drop(AVPacket *);
+    MyAVPacketList *pool_acquire();
+    void account_added(AVPacket *);
+    /**
+     * 返回值为真表示这个packet在丢弃的范围内，调用者需要丢弃
+     * */
+    int account_removed(AVPacket *);
+    void signal_continue();
     int put_internal(AVPacket *);
+    int put_batch_spsc(AVPacket **, int);
+    int get_batch_spsc(MyAVPacketList **, int, int);
+    void wake_spsc(std::atomic<int> &waiting, int ready);
+    void signal_consumer(int force);
+    Uint32 consumer_wait_timeout();
+    Uint32 producer_wait_timeout();
 
 public:
     PacketQueue();
-    int init();
+    /**
+     * spsc_capacity > 0 时使用无锁环形队列，只允许一个线程put、一个线程get，
+     * 只有在队列为空或已满时才会加锁等待
+     * */
+    int init(int spsc_capacity = 0);
     void start();
     void abort();
     void destory();
+    /**
+     * 读取一个packet节点，用完之后必须调用release归还，不能delete
+     * */
     MyAVPacketList *get(int);
+    /**
+     * 一次加锁最多读取nb个packet节点到nodes中，返回读取到的个数，终止时返回负数。
+     * block为1时至少等待读取到一个
+     * */
+    int get_batch(MyAVPacketList **nodes, int nb, int block);
+    /**
+     * 归还get得到的节点到packet pool
+     * */
+    void release(MyAVPacketList *);
     int put(AVPacket *);
+    /**
+     * 一次加锁写入nb个packet，返回写入的个数，失败返回负数
+     * */
+    int put_batch(AVPacket **pkts, int nb);
     /**
      * 将队列中的packet全部读取出来
      * */
     void flush(); 
     int isAbort();
+    /**
+     * 使队列中已有的数据全部过期，不需要停止任何线程，消费者根据serial跳过过期的数据
+     * */
+    int next_serial();
+    int get_serial();
+    void pool_stats(int64_t *hits, int64_t *misses);
+    /**
+     * 无锁读取队列当前的状态快照
+     * */
+    void stats(QueueStats *stats);
+    /**
+     * 设置队列的字节数和时长(秒)上限，time_base为队列中packet的时间基
+     * */
+    void set_limits(int max_bytes, double max_seconds, AVRational time_base);
+    /**
+     * 队列从上限以上回落时，在cond上唤醒等待的读取线程
+     * */
+    void set_continue_cond(SDL_mutex *mutex, SDL_cond *cond);
+    /**
+     * 设置唤醒的水位，减少每个packet都唤醒对方带来的线程切换。默认都为1，即每次都唤醒
+     * */
+    void set_wakeup_thresholds(int consumer_wake_threshold, int producer_wake_space, int max_delay_ms);
+    /**
+     * 开启过载丢包，latency_budget为允许缓存的最大时长(秒)，需要先通过set_limits设置time_base
+     * */
+    void set_overload_policy(double latency_budget, AVCodecParameters *codecpar);
+    /**
+     * 队列中的数据是否已经达到上限
+     * */
+    int has_enough();
+    int is_empty();
     ~PacketQueue();
 };
 
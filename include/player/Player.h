@@ -6,26 +6,159 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
-#include "PacketQueue.h"
-#include "FrameQueue.h"
-#include "Decoder.h"
 #include <SDL2/SDL.h>
 #include <libavutil/time.h>
+#include <libavutil/cpu.h>
 }
+#include "PacketQueue.h"
+#include "FrameQueue.h"
+#include "Decoder.h"
+#include "FramePool.h"
+#include "AudioRing.h"
+#include "Clock.h"
+#include "KeyframeIndex.h"
+#include "SliceScaler.h"
 
 #define VIDEO_PICTURE_QUEUE_SIZE 3
-#define SAMPLE_QUEUE_SIZE 9
+#define MAX_PACKET_BATCH 32
+#define READ_EOF_WAIT_MS 100 //读取到文件末尾后，读取线程每次等待seek或者退出的时间
+
+#define REFRESH_RATE 0.01           //没有可显示的frame时轮询的间隔(秒)
+#define RENDER_MAX_SLEEP 0.1        //渲染循环每次最多睡眠的时间(秒)，保证能及时退出
+#define RENDER_EVENT_SLICE_US 10000 //等待下一帧时每隔这段时间(微秒)处理一次输入事件
+#define RENDER_SPIN_US 1000         //睡眠的最后这段时间(微秒)让出cpu轮询，不依赖系统定时器的精度
+#define AV_SYNC_THRESHOLD_MIN 0.04  //视频同步的最小阈值
+#define AV_SYNC_THRESHOLD_MAX 0.1   //视频同步的最大阈值，显示落后超过这个时间就重新对齐frame_timer，不再追赶
+#define AV_SYNC_FRAMEDUP_THRESHOLD 0.1 //帧显示时间超过这个值时，视频超前不再通过重复显示来等待
+#define SAMPLE_CORRECTION_PERCENT_MAX 10 //音频同步时每个frame的采样数最多调整的百分比
+#define AUDIO_DIFF_AVG_NB 20        //计算音频时钟平均偏差使用的frame个数
+
+enum
+{
+    AV_SYNC_AUDIO_MASTER, //默认以音频为主时钟
+    AV_SYNC_VIDEO_MASTER,
+    AV_SYNC_EXTERNAL_CLOCK,
+};
+
+#define AUDIO_MIN_BUFFER_SIZE 512        //SDL音频回调的最小采样数
+#define AUDIO_MAX_CALLBACKS_PER_SEC 30   //自动选择回调大小时，每秒最多回调的次数
+#define AUDIO_RING_WAIT_MS 10            //音频缓冲区已满时解码线程每次最多休眠的时间
+
+#define DECODE_MAX_AUTO_THREADS 32        //自动模式下解码线程数的上限
+#define DECODE_FRAME_THREADS_MIN_PIXELS (1280 * 720) //自动模式下达到这个分辨率才使用frame多线程
+
+#define SEEK_SHORT_STEP 10.0 //左右键seek的步长(秒)
+#define SEEK_LONG_STEP 60.0  //上下键seek的步长(秒)
+
+#define PLAYBACK_RATE_MIN 0.5            //播放速度的范围
+#define PLAYBACK_RATE_MAX 16.0
+#define PLAYBACK_KEYFRAME_ONLY_RATE 4.0  //默认达到这个速度后只解码关键帧
+
+enum
+{
+    PLAYBACK_NORMAL,         //正常速度，播放音频
+    PLAYBACK_MUTED,          //倍速时不输出音频，以外部时钟为主时钟，解码所有frame
+    PLAYBACK_KEYFRAMES_ONLY, //读取线程只把关键帧送入队列，解码器只解码关键帧
+};
 
 #define FF_QUIT_EVENT (SDL_USEREVENT + 2)
-#define FF_REFRESH_TIMER (SDL_USEREVENT + 1)
+#define FF_STATS_EVENT (SDL_USEREVENT + 3) //定时器请求主线程输出队列状态
 
 int read_thread(void *arg);
+int audio_thread(void *arg);
+void sdl_audio_callback(void *opaque, Uint8 *stream, int len);
 int video_thread(void *arg);
 
-Uint32 sdl_refresh_timer_cb(Uint32 interval, void *opaque);
+Uint32 sdl_stats_timer_cb(Uint32 interval, void *opaque);
+void log_queue_stats(const char *name, const QueueStats *stats);
+void log_latency_stats(const char *name, const LatencyStats *stats);
+int64_t peak_memory_bytes();
 
 class Player;
 
+/**
+ * 每个播放会话的配置，由命令行解析后传给VideoState::init
+ * */
+struct PlayerOptions
+{
+    int spsc_queue_capacity = 0; //>0 时packet queue使用无锁单生产者单消费者环形队列
+    int max_queue_bytes = 15 * 1024 * 1024; //每个packet queue最多缓存的字节数，0表示不限制
+    double max_queue_seconds = 0;           //每个packet queue最多缓存的时长(秒)，0表示不限制
+    int packet_batch_size = 1;              //read_thread每次写入队列的packet个数，最大MAX_PACKET_BATCH
+    double stats_interval = 0;              //定时输出队列状态的间隔(秒)，0表示不输出
+    int packet_wake_batch = 1;              //packet queue积攒多少个packet才唤醒解码线程
+    int frame_wake_space = 1;               //frame queue空出多少个位置才唤醒解码线程
+    int wake_max_delay_ms = 10;             //上面两项大于1时，被推迟唤醒的线程最多等待的时间
+    int frame_queue_size = VIDEO_PICTURE_QUEUE_SIZE; //video frame queue的深度
+    int frame_queue_max_size = 0;           //大于frame_queue_size时开启自适应深度，深度不超过该值
+    int frame_pool = 1;                     //视频解码使用VideoState中的帧缓存池
+    double latency_budget = 0;              //video_queue允许积压的时长(秒)，超过后按关键帧丢包，0表示不丢包
+    int framedrop = 1;                      //显示已经来不及的frame直接丢弃
+    int decode_threads = 0;                 //视频解码线程数，0表示按cpu核数自动选择
+    int decode_thread_type = 0;             //FF_THREAD_FRAME或FF_THREAD_SLICE，0表示自动选择
+    int low_latency = 0;                    //低延迟模式，自动选择时不使用会增加延迟的frame多线程
+    int audio_buffer_samples = 0;           //SDL音频回调每次请求的采样数，越小延迟越低，0表示按采样率自动选择
+    int audio_ring_ms = 200;                //重采样后的PCM缓冲区时长(毫秒)
+    int av_sync_type = AV_SYNC_AUDIO_MASTER; //音视频同步的主时钟
+    int decode_skip_max_level = DECODE_SKIP_MAX_LEVEL; //解码跟不上时最多降级到的级别，0表示不降级
+    int vsync = 1;                          //按显示器的垂直同步呈现
+    int audio_disable = 0;                  //不播放音频
+    int headless = 0;                       //不创建窗口，frame显示到空的输出，播放结束后输出benchmark结果
+    int bench_fast = 0;                     //headless时不按时间显示，frame解码出来就立即显示
+    double playback_rate = 1.0;             //播放速度
+    double keyframe_only_rate = PLAYBACK_KEYFRAME_ONLY_RATE; //播放速度达到这个值后只解码关键帧
+    int scale_threads = 0;                  //SDL不支持的像素格式转换时使用的线程数，0表示按cpu核数自动选择
+    int scale_flags = SWS_BICUBIC;          //像素格式转换的算法，预览时可以用SWS_FAST_BILINEAR
+};
+
+static inline const char *sync_type_name(int sync_type)
+{
+    switch (sync_type)
+    {
+    case AV_SYNC_VIDEO_MASTER:
+        return "video";
+    case AV_SYNC_AUDIO_MASTER:
+        return "audio";
+    default:
+        return "external";
+    }
+}
+
+static inline const char *thread_type_name(int thread_type)
+{
+    switch (thread_type)
+    {
+    case FF_THREAD_FRAME:
+        return "frame";
+    case FF_THREAD_SLICE:
+        return "slice";
+    default:
+        return "no";
+    }
+}
+
+/**
+ * 音频的格式参数
+ * */
+struct AudioParams
+{
+    int freq = 0;
+    int channels = 0;
+    int64_t channel_layout = 0;
+    enum AVSampleFormat fmt = AV_SAMPLE_FMT_NONE;
+    int frame_size = 0;    //一个采样点(所有声道)的字节数
+    int bytes_per_sec = 0;
+};
+
+/**
+ * 精确seek的目标：serial为seek之后队列的serial，这个serial的frame在到达pts(秒)之前解码后丢弃
+ * */
+struct SeekTarget
+{
+    std::atomic<int> serial{-1};
+    std::atomic<double> pts{NAN};
+};
+
 class VideoState
 {
 public:
@@ -33,8 +166,26 @@ public:
     char *filename;
     AVFormatContext *format_ctx = NULL;
     AVInputFormat *iformat = NULL;
-    SDL_Thread *read_tid; //读取线程id
-    int eof = 0;          //是否到文件末尾
+    SDL_Thread *read_tid = NULL; //读取线程id
+    std::atomic<int> eof{0}; //是否到文件末尾，由读取线程写入，headless时渲染循环据此判断播放结束
+    SDL_mutex *continue_read_mutex = NULL;
+    SDL_cond *continue_read_cond = NULL; //packet queue中的数据回落到上限以下时唤醒读取线程
+    std::atomic<int64_t> read_waits{0};    //读取线程因队列达到上限而等待的次数
+    std::atomic<int64_t> read_wait_us{0};
+
+    //seek相关
+    std::atomic<int> seek_req{0};
+    std::atomic<int64_t> seek_pos{0};          //seek的目标时间，AV_TIME_BASE
+    std::atomic<int64_t> seek_request_time{0}; //发出seek请求的时间，目标frame显示后清零
+    SeekTarget video_seek;
+    SeekTarget audio_seek;
+    KeyframeIndex keyframe_index;              //只在读取线程中访问
+
+    //倍速播放
+    std::atomic<double> playback_rate{1.0};    //请求的播放速度，渲染循环据此设置视频和外部时钟的速度
+    std::atomic<int> audio_muted{0};           //倍速播放时不输出音频
+    std::atomic<int> keyframes_only{0};        //由读取线程设置
+    std::atomic<int64_t> nonkey_dropped{0};    //只解码关键帧时读取线程丢弃的packet个数
 
     //video related
     int video_last_stream_index;
@@ -43,37 +194,580 @@ public:
     AVCodecContext *video_codec_ctx = NULL;
     PacketQueue *video_queue = NULL;
     FrameQueue *video_frame_queue = NULL;
-    struct SwsContext *video_sws_ctx = NULL;
     SDL_Texture *video_texture;
     Decoder *video_decoder = NULL;
+    int video_thread_type = 0;  //视频解码器实际使用的多线程方式和线程数
+    int video_thread_count = 1;
+    DecodeSkipPolicy video_skip_policy;
+    FramePool *video_frame_pool = NULL; //视频解码器的帧缓存池
 
     //时间相关
-    double video_current_pts;
-    int64_t video_current_pts_time;
+    Clock audclk;
+    Clock vidclk;
+    Clock extclk;
+    double max_frame_duration = 10.0; //相邻两帧的pts差值超过这个值认为是时间戳不连续
     double frame_timer;
     double frame_last_pts;
     double frame_last_delay;
+    int frame_last_serial = -1;
+    std::atomic<int64_t> frame_drops_late{0}; //显示时已经过期而丢弃的frame个数
+    std::atomic<int64_t> frame_drops_early{0}; //解码后已经落后于主时钟，没有写入frame queue的frame个数
 
     //audio related
     int audio_last_stream_index;
     int audio_stream_index;
     AVStream *audio_stream = NULL;
     PacketQueue *audio_queue = NULL;
-    FrameQueue *audio_frame_queue = NULL;
     Decoder *audio_decoder = NULL;
     struct SwrContext *audio_swr_ctx = NULL;
+    SDL_AudioDeviceID audio_dev = 0;
+    AudioParams audio_src;          //解码输出的格式，变化时重新创建audio_swr_ctx
+    AudioParams audio_tgt;          //SDL音频设备的格式
+    int audio_hw_buf_size = 0;      //SDL回调每次请求的字节数
+    AudioRing *audio_ring = NULL;   //音频解码线程写入，SDL回调读取
+    uint8_t *audio_buf = NULL;      //重采样的输出
+    unsigned int audio_buf_size = 0;
+    double audio_diff_cum = 0;      //音频时钟与主时钟偏差的加权累计，只由音频解码线程访问
+    double audio_diff_avg_coef = 0;
+    double audio_diff_threshold = 0;
+    int audio_diff_avg_count = 0;
     //quit
-    int abort_request = 0;
+    std::atomic<int> abort_request{0}; //读取线程和中断回调在其他线程中读取
 
     //player
     Player *player = NULL;
+    PlayerOptions opts;
+
+    //流水线各阶段的统计
+    int64_t start_time = 0;
+    std::atomic<int64_t> frames_decoded{0};
+    std::atomic<int64_t> frames_displayed{0};
+    LatencyStats demux_latency;  //av_read_frame
+    LatencyStats decode_latency; //解码一帧，包括等待packet
+    LatencyStats queue_latency;  //frame从写入frame queue到显示
+    LatencyStats render_latency; //上传和呈现
+    LatencyStats seek_latency;   //从seek请求到目标frame显示
 
 private:
+    /**
+     * 有解码线程在消费的队列才参与上限的判断
+     * */
+    int stream_is_active(PacketQueue *queue, int stream_index)
+    {
+        return stream_index >= 0 && !queue->isAbort();
+    }
+
+    /**
+     * 实时流(rtp/rtsp/udp等)，解码延迟会直接累加到播放延迟上
+     * */
+    int is_realtime()
+    {
+        if (!strcmp(format_ctx->iformat->name, "rtp") || !strcmp(format_ctx->iformat->name, "rtsp") ||
+            !strcmp(format_ctx->iformat->name, "sdp"))
+        {
+            return 1;
+        }
+        if (format_ctx->pb && (!strncmp(format_ctx->url, "rtp:", 4) || !strncmp(format_ctx->url, "udp:", 4)))
+        {
+            return 1;
+        }
+        return 0;
+    }
+
+    /**
+     * 按配置设置视频解码的多线程方式，需要在avcodec_open2之前调用。
+     * 自动模式：低延迟或分辨率较低时用slice多线程(不增加延迟)，否则用frame多线程(吞吐量更高，
+     * 但每个线程会增加一帧的延迟)
+     * */
+    void configure_decode_threads(AVCodecContext *codec_ctx, const AVCodec *codec)
+    {
+        int threads = opts.decode_threads;
+        int type = opts.decode_thread_type;
+        if (!type)
+        {
+            int low_latency = opts.low_latency || is_realtime();
+            int can_frame = codec->capabilities & AV_CODEC_CAP_FRAME_THREADS;
+            if (can_frame && !low_latency && codec_ctx->width * codec_ctx->height >= DECODE_FRAME_THREADS_MIN_PIXELS)
+            {
+                type = FF_THREAD_FRAME;
+            }
+            else
+            {
+                type = FF_THREAD_SLICE;
+            }
+        }
+        if (threads <= 0)
+        {
+            //libavcodec自己的自动模式最多只用16个线程
+            threads = FFMIN(av_cpu_count(), DECODE_MAX_AUTO_THREADS);
+        }
+        codec_ctx->thread_type = type;
+        codec_ctx->thread_count = threads;
+    }
+
 public:
     VideoState()
     {
     }
 
+    /**
+     * 任意一个正在解码的stream的packet queue达到上限时，读取线程需要等待。
+     * 交织的文件中读取另一个stream也会继续填满这个队列，只有这样每个队列的内存才有上限
+     * */
+    int queues_have_enough()
+    {
+        int video_active = stream_is_active(video_queue, video_stream_index);
+        int audio_active = stream_is_active(audio_queue, audio_stream_index) && !audio_muted;
+        return (video_active && video_queue->has_enough()) ||
+               (audio_active && audio_queue->has_enough());
+    }
+
+    /**
+     * 文件已经读取完，并且所有的frame都已经显示
+     * */
+    int playback_finished()
+    {
+        if (!eof)
+        {
+            return 0;
+        }
+        if (video_stream && (!video_decoder->is_finished() || video_frame_queue->nb_remaining() > 0))
+        {
+            return 0;
+        }
+        return !audio_stream || (audio_decoder->is_finished() && audio_ring->fill() == 0);
+    }
+
+    /**
+     * 输出benchmark的结果：帧率、各阶段的耗时和内存峰值
+     * */
+    void print_benchmark()
+    {
+        double elapsed = (av_gettime_relative() - start_time) / 1000000.0;
+        logi("benchmark: %lld frames decoded, %lld displayed in %.3fs, decode %.1f fps, display %.1f fps\n",
+             (long long)frames_decoded, (long long)frames_displayed, elapsed,
+             elapsed > 0 ? frames_decoded / elapsed : 0, elapsed > 0 ? frames_displayed / elapsed : 0);
+        log_latency_stats("demux", &demux_latency);
+        log_latency_stats("decode", &decode_latency);
+        log_latency_stats("frame_queue", &queue_latency);
+        log_latency_stats("render", &render_latency);
+        log_latency_stats("seek", &seek_latency);
+        logi("benchmark: peak memory %.1f MiB\n", peak_memory_bytes() / (1024.0 * 1024.0));
+    }
+
+    /**
+     * 输出所有队列的状态，可以在任意线程调用
+     * */
+    void dump_stats()
+    {
+        QueueStats stats;
+        logi("read_thread: blocked %lld times, %.1f ms\n", (long long)read_waits, read_wait_us / 1000.0);
+        logi("video_refresh: %lld late frames dropped, %lld early frames dropped\n",
+             (long long)frame_drops_late, (long long)frame_drops_early);
+        log_latency_stats("seek", &seek_latency);
+        logi("playback: rate %.2fx%s%s, %lld non-key packets dropped\n", (double)playback_rate,
+             audio_muted ? ", audio muted" : "", keyframes_only ? ", keyframes only" : "", (long long)nonkey_dropped);
+        logi("sync: master=%s a-v=%.3fs\n", sync_type_name(get_master_sync_type()), audclk.get() - vidclk.get());
+        if (video_stream)
+        {
+            logi("video_decoder: %s threading, %d threads, level %d (%s, max %d, %lld changes)\n",
+                 thread_type_name(video_thread_type), video_thread_count,
+                 video_skip_policy.get_level(), DecodeSkipPolicy::level_name(video_skip_policy.get_level()),
+                 video_skip_policy.get_max_level_seen(), (long long)video_skip_policy.get_changes());
+        }
+        if (video_queue)
+        {
+            video_queue->stats(&stats);
+            log_queue_stats("video_queue", &stats);
+        }
+        if (video_frame_queue)
+        {
+            stats = QueueStats();
+            video_frame_queue->stats(&stats);
+            log_queue_stats("video_frame_queue", &stats);
+        }
+        if (audio_queue)
+        {
+            stats = QueueStats();
+            audio_queue->stats(&stats);
+            log_queue_stats("audio_queue", &stats);
+        }
+        if (audio_ring)
+        {
+            stats = QueueStats();
+            audio_ring->stats(&stats);
+            log_queue_stats("audio_ring", &stats);
+        }
+    }
+
+    int get_master_sync_type()
+    {
+        if (opts.av_sync_type == AV_SYNC_VIDEO_MASTER)
+        {
+            return video_stream ? AV_SYNC_VIDEO_MASTER : AV_SYNC_AUDIO_MASTER;
+        }
+        if (opts.av_sync_type == AV_SYNC_AUDIO_MASTER)
+        {
+            return audio_stream && !audio_muted ? AV_SYNC_AUDIO_MASTER : AV_SYNC_EXTERNAL_CLOCK;
+        }
+        return AV_SYNC_EXTERNAL_CLOCK;
+    }
+
+    /**
+     * 当前主时钟的值(秒)
+     * */
+    double get_master_clock()
+    {
+        switch (get_master_sync_type())
+        {
+        case AV_SYNC_VIDEO_MASTER:
+            return vidclk.get();
+        case AV_SYNC_AUDIO_MASTER:
+            return audclk.get();
+        default:
+            return extclk.get();
+        }
+    }
+
+    /**
+     * 请求seek到pos(秒，与pts相同的时间轴)，由读取线程执行，可以在任意线程调用
+     * */
+    void stream_seek(double pos)
+    {
+        if (format_ctx && format_ctx->start_time != AV_NOPTS_VALUE)
+        {
+            pos = FFMAX(pos, format_ctx->start_time / (double)AV_TIME_BASE);
+        }
+        seek_pos = (int64_t)(pos * AV_TIME_BASE);
+        seek_request_time = av_gettime_relative();
+        seek_req = 1;
+        //读取线程可能正在等待队列回落
+        SDL_LockMutex(continue_read_mutex);
+        SDL_CondSignal(continue_read_cond);
+        SDL_UnlockMutex(continue_read_mutex);
+    }
+
+    /**
+     * 从当前播放位置前后seek incr秒
+     * */
+    void stream_seek_relative(double incr)
+    {
+        double pos = get_master_clock();
+        if (isnan(pos))
+        {
+            //时钟还没有更新(比如连续seek)，从上一次的目标开始
+            pos = seek_pos / (double)AV_TIME_BASE;
+        }
+        stream_seek(pos + incr);
+    }
+
+    /**
+     * 播放速度对应的播放方式
+     * */
+    int playback_mode(double rate)
+    {
+        if (rate >= opts.keyframe_only_rate)
+        {
+            return PLAYBACK_KEYFRAMES_ONLY;
+        }
+        return rate != 1.0 ? PLAYBACK_MUTED : PLAYBACK_NORMAL;
+    }
+
+    /**
+     * 设置播放速度，可以在任意线程调用。时钟的速度由渲染循环更新；
+     * 播放方式改变时从当前位置seek，让音频的开关和关键帧的过滤从同一个serial开始生效
+     * */
+    void set_playback_rate(double rate)
+    {
+        if (!video_stream)
+        {
+            logw("playback rate is only supported with a video stream\n");
+            return;
+        }
+        rate = av_clipd(rate, PLAYBACK_RATE_MIN, PLAYBACK_RATE_MAX);
+        double old = playback_rate.exchange(rate);
+        if (rate == old)
+        {
+            return;
+        }
+        logi("playback rate %.2fx\n", rate);
+        if (playback_mode(rate) != playback_mode(old))
+        {
+            double pos = get_master_clock();
+            if (isnan(pos))
+            {
+                pos = seek_pos / (double)AV_TIME_BASE;
+            }
+            stream_seek(pos);
+        }
+    }
+
+    /**
+     * 在读取线程中按当前的播放速度切换播放方式，在打开stream之后和每次seek时调用
+     * */
+    void apply_playback_mode()
+    {
+        int mode = playback_mode(playback_rate);
+        keyframes_only = mode == PLAYBACK_KEYFRAMES_ONLY;
+        audio_muted = mode != PLAYBACK_NORMAL;
+        //解码器在serial变化时重新应用降级级别
+        video_skip_policy.set_min_level(keyframes_only ? DECODE_SKIP_MAX_LEVEL : 0);
+    }
+
+    /**
+     * 在读取线程中执行seek：目标之前最近的关键帧已经在索引中时直接定位到它，否则由
+     * avformat_seek_file定位到目标之前的关键帧。然后让队列中已有的数据过期，
+     * 解码线程把目标之前的frame解码后丢弃
+     * */
+    int do_seek()
+    {
+        int64_t target = seek_pos;
+        int64_t start = av_gettime_relative();
+        KeyframeEntry key;
+        int indexed = 0;
+        int ret = -1;
+        if (video_stream && keyframe_index.lookup(av_rescale_q(target, AV_TIME_BASE_Q, video_stream->time_base), &key))
+        {
+            indexed = 1;
+            //只有时间戳不连续的格式(如mpegts)按字节定位，和ffplay一样排除ogg；
+            //mp4/mkv/avi等packet的位置在chunk/cluster内部，按字节定位后demuxer重新同步可能越过这个关键帧
+            if (key.pos >= 0 && (format_ctx->iformat->flags & AVFMT_TS_DISCONT) &&
+                !(format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) && strcmp("ogg", format_ctx->iformat->name))
+            {
+                ret = avformat_seek_file(format_ctx, -1, key.pos, key.pos, key.pos, AVSEEK_FLAG_BYTE);
+            }
+            else
+            {
+                ret = avformat_seek_file(format_ctx, video_stream_index, key.pts, key.pts, key.pts, AVSEEK_FLAG_BACKWARD);
+            }
+        }
+        if (ret < 0)
+        {
+            indexed = 0;
+            //max_ts为目标时间，保证落在目标之前的关键帧上
+            ret = avformat_seek_file(format_ctx, -1, INT64_MIN, target, target, 0);
+        }
+        seek_req = 0;
+        if (ret < 0)
+        {
+            loge("%s: error while seeking to %.3fs: %s\n", filename, target / (double)AV_TIME_BASE, av_err2str(ret));
+            seek_request_time = 0;
+            return ret;
+        }
+        apply_playback_mode();
+        //先设置目标时间，再让解码线程看到新的serial
+        video_seek.pts = target / (double)AV_TIME_BASE;
+        video_seek.serial = video_queue->next_serial();
+        audio_seek.pts = target / (double)AV_TIME_BASE;
+        audio_seek.serial = audio_queue->next_serial();
+        keyframe_index.new_run();
+        eof = 0;
+        logi("seek to %.3fs (%s, %d keyframes indexed) in %.1fms\n", target / (double)AV_TIME_BASE,
+             indexed ? "index" : "search", keyframe_index.size(), (av_gettime_relative() - start) / 1000.0);
+        return 0;
+    }
+
+    /**
+     * 精确seek时，serial为seek之后的数据并且end(frame结束的时间，秒)还没有到达目标时，frame需要丢弃
+     * */
+    int before_seek_target(SeekTarget *target, int serial, double end)
+    {
+        return serial == target->serial && end < target->pts;
+    }
+
+    /**
+     * 视频不是主时钟时，按视频时钟与主时钟的偏差修正到下一帧的延时：
+     * 落后时缩短延时，超前时延长延时
+     * */
+    double compute_target_delay(double delay)
+    {
+        double sync_threshold, diff = 0;
+        if (get_master_sync_type() != AV_SYNC_VIDEO_MASTER)
+        {
+            diff = vidclk.get() - get_master_clock();
+            sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
+            if (!isnan(diff) && fabs(diff) < max_frame_duration)
+            {
+                if (diff <= -sync_threshold)
+                {
+                    delay = FFMAX(0, delay + diff);
+                }
+                else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD)
+                {
+                    delay = delay + diff;
+                }
+                else if (diff >= sync_threshold)
+                {
+                    delay = 2 * delay;
+                }
+            }
+        }
+        logd("video: delay=%0.3f A-V=%f\n", delay, -diff);
+        return delay;
+    }
+
+    /**
+     * 音频不是主时钟时，返回为了追上主时钟这个frame应该输出的采样数，
+     * 由audio_resample通过swr_set_compensation平滑地增减采样
+     * */
+    int synchronize_audio(int nb_samples)
+    {
+        int wanted_nb_samples = nb_samples;
+        if (get_master_sync_type() != AV_SYNC_AUDIO_MASTER)
+        {
+            double diff = audclk.get() - get_master_clock();
+            if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD)
+            {
+                audio_diff_cum = diff + audio_diff_avg_coef * audio_diff_cum;
+                if (audio_diff_avg_count < AUDIO_DIFF_AVG_NB)
+                {
+                    //还没有足够的数据计算平均偏差
+                    audio_diff_avg_count++;
+                }
+                else
+                {
+                    double avg_diff = audio_diff_cum * (1.0 - audio_diff_avg_coef);
+                    if (fabs(avg_diff) >= audio_diff_threshold)
+                    {
+                        wanted_nb_samples = nb_samples + (int)(diff * audio_src.freq);
+                        int min_nb_samples = nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+                        int max_nb_samples = nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+                        wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
+                    }
+                }
+            }
+            else
+            {
+                //偏差太大，可能是初始化或者seek，重新统计
+                audio_diff_avg_count = 0;
+                audio_diff_cum = 0;
+            }
+        }
+        return wanted_nb_samples;
+    }
+
+    /**
+     * 打开SDL音频设备，实际的输出格式保存在audio_tgt中，返回回调每次请求的字节数
+     * */
+    int audio_open(int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate)
+    {
+        SDL_AudioSpec wanted_spec, spec;
+        if (!wanted_channel_layout || wanted_nb_channels != av_get_channel_layout_nb_channels(wanted_channel_layout))
+        {
+            wanted_channel_layout = av_get_default_channel_layout(wanted_nb_channels);
+            wanted_channel_layout &= ~AV_CH_LAYOUT_STEREO_DOWNMIX;
+        }
+        wanted_spec.channels = av_get_channel_layout_nb_channels(wanted_channel_layout);
+        wanted_spec.freq = wanted_sample_rate;
+        if (wanted_spec.freq <= 0 || wanted_spec.channels <= 0)
+        {
+            loge("Invalid sample rate or channel count!\n");
+            return -1;
+        }
+        wanted_spec.format = AUDIO_S16SYS;
+        wanted_spec.silence = 0;
+        if (opts.audio_buffer_samples > 0)
+        {
+            wanted_spec.samples = opts.audio_buffer_samples;
+        }
+        else
+        {
+            wanted_spec.samples = FFMAX(AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / AUDIO_MAX_CALLBACKS_PER_SEC));
+        }
+        wanted_spec.callback = sdl_audio_callback;
+        wanted_spec.userdata = this;
+        audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+        if (!audio_dev)
+        {
+            loge("SDL_OpenAudioDevice (%d channels, %d Hz): %s\n", wanted_spec.channels, wanted_spec.freq, SDL_GetError());
+            return -1;
+        }
+        if (spec.channels != wanted_spec.channels)
+        {
+            wanted_channel_layout = av_get_default_channel_layout(spec.channels);
+            if (!wanted_channel_layout)
+            {
+                loge("SDL advised channel count %d is not supported!\n", spec.channels);
+                SDL_CloseAudioDevice(audio_dev);
+                audio_dev = 0;
+                return -1;
+            }
+        }
+
+        audio_tgt.fmt = AV_SAMPLE_FMT_S16;
+        audio_tgt.freq = spec.freq;
+        audio_tgt.channel_layout = wanted_channel_layout;
+        audio_tgt.channels = spec.channels;
+        audio_tgt.frame_size = av_samples_get_buffer_size(NULL, audio_tgt.channels, 1, audio_tgt.fmt, 1);
+        audio_tgt.bytes_per_sec = av_samples_get_buffer_size(NULL, audio_tgt.channels, audio_tgt.freq, audio_tgt.fmt, 1);
+        audio_hw_buf_size = spec.size;
+        logi("audio output: %d Hz, %d channels, %d samples per callback\n", spec.freq, spec.channels, spec.samples);
+        return spec.size;
+    }
+
+    /**
+     * 将解码后的frame重采样成audio_tgt的格式，结果保存在audio_buf中，返回字节数。
+     * wanted_nb_samples与frame的采样数不同时，按差值做采样补偿
+     * */
+    int audio_resample(AVFrame *frame, int wanted_nb_samples)
+    {
+        int64_t dec_channel_layout = (frame->channel_layout && frame->channels == av_get_channel_layout_nb_channels(frame->channel_layout))
+                                         ? frame->channel_layout
+                                         : av_get_default_channel_layout(frame->channels);
+        if (!audio_swr_ctx || frame->format != audio_src.fmt || dec_channel_layout != audio_src.channel_layout ||
+            frame->sample_rate != audio_src.freq)
+        {
+            swr_free(&audio_swr_ctx);
+            audio_swr_ctx = swr_alloc_set_opts(NULL, audio_tgt.channel_layout, audio_tgt.fmt, audio_tgt.freq,
+                                               dec_channel_layout, (AVSampleFormat)frame->format, frame->sample_rate, 0, NULL);
+            if (!audio_swr_ctx || swr_init(audio_swr_ctx) < 0)
+            {
+                loge("Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
+                     frame->sample_rate, av_get_sample_fmt_name((AVSampleFormat)frame->format), frame->channels,
+                     audio_tgt.freq, av_get_sample_fmt_name(audio_tgt.fmt), audio_tgt.channels);
+                swr_free(&audio_swr_ctx);
+                return -1;
+            }
+            audio_src.channel_layout = dec_channel_layout;
+            audio_src.channels = frame->channels;
+            audio_src.freq = frame->sample_rate;
+            audio_src.fmt = (AVSampleFormat)frame->format;
+        }
+
+        if (wanted_nb_samples != frame->nb_samples)
+        {
+            if (swr_set_compensation(audio_swr_ctx, (wanted_nb_samples - frame->nb_samples) * audio_tgt.freq / frame->sample_rate,
+                                     wanted_nb_samples * audio_tgt.freq / frame->sample_rate) < 0)
+            {
+                loge("swr_set_compensation() failed\n");
+                return -1;
+            }
+        }
+        int out_count = (int64_t)wanted_nb_samples * audio_tgt.freq / frame->sample_rate + 256;
+        int out_size = av_samples_get_buffer_size(NULL, audio_tgt.channels, out_count, audio_tgt.fmt, 0);
+        if (out_size < 0)
+        {
+            loge("av_samples_get_buffer_size() failed\n");
+            return -1;
+        }
+        av_fast_malloc(&audio_buf, &audio_buf_size, out_size);
+        if (!audio_buf)
+        {
+            return AVERROR(ENOMEM);
+        }
+        int len = swr_convert(audio_swr_ctx, &audio_buf, out_count, (const uint8_t **)frame->extended_data, frame->nb_samples);
+        if (len < 0)
+        {
+            loge("swr_convert() failed\n");
+            return -1;
+        }
+        if (len == out_count)
+        {
+            logw("audio buffer is probably too small\n");
+        }
+        return len * audio_tgt.frame_size;
+    }
+
     int stream_componet_open(int stream_index)
     {
         int ret = 0;
@@ -103,6 +797,14 @@ public:
             ret = -1;
             goto fail;
         }
+        if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            configure_decode_threads(codec_ctx, codec);
+            if (video_frame_pool)
+            {
+                video_frame_pool->attach(codec_ctx, codec);
+            }
+        }
         //打开编解码器
         ret = avcodec_open2(codec_ctx, codec, NULL);
         if (ret < 0)
@@ -115,16 +817,57 @@ public:
         switch (codec_ctx->codec_type)
         {
         case AVMEDIA_TYPE_AUDIO:
+            //按解码器的参数打开SDL音频设备，SDL可能会改变采样率和声道数
+            ret = audio_open(codec_ctx->channel_layout, codec_ctx->channels, codec_ctx->sample_rate);
+            if (ret < 0)
+            {
+                goto fail;
+            }
+            //偏差的平均值只在超过一次回调的时长时才修正
+            audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
+            audio_diff_avg_count = 0;
+            audio_diff_threshold = (double)audio_hw_buf_size / audio_tgt.bytes_per_sec;
+
+            audio_ring = new AudioRing();
+            ret = audio_ring->init(FFMAX(audio_hw_buf_size * 2, (int)((int64_t)audio_tgt.bytes_per_sec * opts.audio_ring_ms / 1000)),
+                                   audio_tgt.frame_size, audio_tgt.bytes_per_sec);
+            if (ret < 0)
+            {
+                goto fail;
+            }
+
             audio_stream_index = stream_index;
             audio_stream = format_ctx->streams[stream_index];
+            audio_queue->set_limits(opts.max_queue_bytes, opts.max_queue_seconds, audio_stream->time_base);
+
+            audio_decoder = new Decoder();
+            ret = audio_decoder->init(codec_ctx, audio_queue, NULL, NULL);
+            if (ret < 0)
+            {
+                loge("Failed to init audio decoder.\n");
+                goto fail;
+            }
+            ret = audio_decoder->start(audio_thread, "audio_thread", this);
+            if (ret < 0)
+            {
+                goto out;
+            }
+            SDL_PauseAudioDevice(audio_dev, 0);
             break;
         case AVMEDIA_TYPE_VIDEO:
             video_stream_index = stream_index;
             video_stream = format_ctx->streams[stream_index];
+            video_queue->set_limits(opts.max_queue_bytes, opts.max_queue_seconds, video_stream->time_base);
+            video_queue->set_overload_policy(opts.latency_budget, video_stream->codecpar);
 
-            frame_timer = (double)av_gettime() / 1000000.0;
+            frame_timer = (double)av_gettime_relative() / 1000000.0;
             frame_last_delay = 40e-3;
-            video_current_pts_time = av_gettime();
+
+            //不支持的多线程方式会被libavcodec忽略，记录实际生效的
+            video_thread_type = codec_ctx->active_thread_type;
+            video_thread_count = video_thread_type ? codec_ctx->thread_count : 1;
+            logi("video decoder %s: %s threading, %d threads\n", codec->name,
+                 thread_type_name(video_thread_type), video_thread_count);
 
             video_decoder = new Decoder();
             ret = video_decoder->init(codec_ctx, video_queue, video_frame_queue, NULL);
@@ -133,6 +876,8 @@ public:
                 loge("Failed to init video decoder.\n");
                 goto fail;
             }
+            video_skip_policy.init(opts.decode_skip_max_level);
+            video_decoder->set_skip_policy(&video_skip_policy);
             ret = video_decoder->start(video_thread, "video_thread", this);
             if (ret < 0)
             {
@@ -146,6 +891,16 @@ public:
         goto out;
 
     fail:
+        if (codec_ctx->codec_type == AVMEDIA_TYPE_AUDIO)
+        {
+            if (audio_dev)
+            {
+                SDL_CloseAudioDevice(audio_dev);
+                audio_dev = 0;
+            }
+            delete audio_ring;
+            audio_ring = NULL;
+        }
         avcodec_free_context(&codec_ctx);
     out:
         return ret;
@@ -162,11 +917,25 @@ public:
         switch (codecpar->codec_type)
         {
         case AVMEDIA_TYPE_AUDIO:
+            //先关闭设备，保证回调不再访问audio_ring
+            if (audio_dev)
+            {
+                SDL_CloseAudioDevice(audio_dev);
+                audio_dev = 0;
+            }
             if (audio_decoder != NULL)
             {
                 delete audio_decoder;
                 audio_decoder = NULL;
             }
+            if (audio_ring != NULL)
+            {
+                delete audio_ring;
+                audio_ring = NULL;
+            }
+            swr_free(&audio_swr_ctx);
+            av_freep(&audio_buf);
+            audio_buf_size = 0;
             audio_stream_index = -1;
             audio_stream = NULL;
             break;
@@ -185,7 +954,7 @@ public:
         }
     }
 
-    int init(const char *filename, const AVInputFormat *iformat)
+    int init(const char *filename, const AVInputFormat *iformat, const PlayerOptions *opts = NULL)
     {
         int ret = 0;
         int err;
@@ -199,33 +968,58 @@ public:
         this->iformat = const_cast<AVInputFormat *>(iformat);
         this->video_last_stream_index = this->video_stream_index = -1;
         this->audio_last_stream_index = this->audio_stream_index = -1;
+        if (opts)
+        {
+            this->opts = *opts;
+        }
+        playback_rate = av_clipd(this->opts.playback_rate, PLAYBACK_RATE_MIN, PLAYBACK_RATE_MAX);
+
+        continue_read_mutex = SDL_CreateMutex();
+        continue_read_cond = SDL_CreateCond();
+        if (!continue_read_mutex || !continue_read_cond)
+        {
+            loge("SDL_CreateMutex/SDL_CreateCond(): %s\n", SDL_GetError());
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
 
         this->video_queue = new PacketQueue();
-        if (!this->video_queue || this->video_queue->init() < 0)
+        if (!this->video_queue || this->video_queue->init(this->opts.spsc_queue_capacity) < 0)
         {
             ret = -1;
             goto fail;
         }
+        this->video_queue->set_continue_cond(continue_read_mutex, continue_read_cond);
 
         this->audio_queue = new PacketQueue();
-        if (!this->audio_queue || this->audio_queue->init() < 0)
+        if (!this->audio_queue || this->audio_queue->init(this->opts.spsc_queue_capacity) < 0)
         {
             ret = -1;
             goto fail;
         }
+        this->audio_queue->set_continue_cond(continue_read_mutex, continue_read_cond);
+        vidclk.init(video_queue);
+        audclk.init(audio_queue);
+        extclk.init(NULL);
+        this->video_queue->set_wakeup_thresholds(this->opts.packet_wake_batch, 1, this->opts.wake_max_delay_ms);
+        this->audio_queue->set_wakeup_thresholds(this->opts.packet_wake_batch, 1, this->opts.wake_max_delay_ms);
 
         this->video_frame_queue = new FrameQueue();
-        if (!this->video_frame_queue || this->video_frame_queue->init(VIDEO_PICTURE_QUEUE_SIZE, video_queue) < 0)
+        if (!this->video_frame_queue || this->video_frame_queue->init(this->opts.frame_queue_size, video_queue, this->opts.frame_queue_max_size) < 0)
         {
             ret = -1;
             goto fail;
         }
+        this->video_frame_queue->set_wakeup_thresholds(1, this->opts.frame_wake_space, this->opts.wake_max_delay_ms);
 
-        this->audio_frame_queue = new FrameQueue();
-        if (!this->audio_frame_queue || this->audio_frame_queue->init(SAMPLE_QUEUE_SIZE, audio_queue) < 0)
+        if (this->opts.frame_pool)
         {
-            ret = -1;
-            goto fail;
+            this->video_frame_pool = new FramePool();
+            if (this->video_frame_pool->init() < 0)
+            {
+                ret = -1;
+                goto fail;
+            }
         }
 
         read_tid = SDL_CreateThread(read_thread, "read_thread", this);
@@ -243,7 +1037,27 @@ public:
     void destory()
     {
         abort_request = 1;
-        // SDL_WaitThread(read_tid, NULL);
+        //读取线程可能在等待队列回落或者阻塞在写入队列中，都需要唤醒
+        if (video_queue)
+        {
+            video_queue->abort();
+        }
+        if (audio_queue)
+        {
+            audio_queue->abort();
+        }
+        if (continue_read_cond)
+        {
+            SDL_LockMutex(continue_read_mutex);
+            SDL_CondSignal(continue_read_cond);
+            SDL_UnlockMutex(continue_read_mutex);
+        }
+        //读取线程退出之后才能关闭stream、format context和队列
+        if (read_tid)
+        {
+            SDL_WaitThread(read_tid, NULL);
+            read_tid = NULL;
+        }
         if (video_stream_index >= 0)
         {
             stream_component_close(video_stream_index);
@@ -272,20 +1086,26 @@ public:
             delete audio_queue;
             audio_queue = NULL;
         }
-        if (audio_frame_queue)
+        if (video_frame_pool)
         {
-            delete audio_frame_queue;
-            audio_frame_queue = NULL;
+            delete video_frame_pool;
+            video_frame_pool = NULL;
         }
 
-        if (video_sws_ctx != NULL)
-        {
-            sws_freeContext(video_sws_ctx);
-        }
         if (audio_swr_ctx != NULL)
         {
             swr_free(&audio_swr_ctx);
         }
+        if (continue_read_cond)
+        {
+            SDL_DestroyCond(continue_read_cond);
+            continue_read_cond = NULL;
+        }
+        if (continue_read_mutex)
+        {
+            SDL_DestroyMutex(continue_read_mutex);
+            continue_read_mutex = NULL;
+        }
 
         av_free(filename);
     }
@@ -305,24 +1125,55 @@ public:
     int screen_width = 0, screen_height = 0;
     int default_width = 640, default_height = 480;
     SDL_Window *window = NULL;
-    SDL_Renderer *renderer = NULL;
+    SDL_Renderer *renderer = NULL; //renderer和texture只在主线程的渲染循环中创建和使用
     SDL_Texture *texture = NULL;
+    SliceScaler *scaler = NULL;    //SDL不支持的像素格式的转换，在渲染循环中第一次需要时创建
+    PlayerOptions options;
+    SDL_TimerID stats_timer = 0;
+    double vsync_period = 0; //开启垂直同步时一次刷新的时间(秒)，否则为0
 
     int quit=0;
 
 private:
     void calculate_display_rect(SDL_Rect *rect, int left, int top, int max_width, int max_height, int width, int height, AVRational sar);
-    void video_refresh_timer(void *arg);
-    void schedule_refresh(int delay);
+    /**
+     * 显示到期的frame，返回距离下一次需要刷新的时间(秒)
+     * */
+    double video_refresh();
+    double frame_delay(Frame *vp);
+    double frame_duration(Frame *vp, Frame *nextvp);
     void video_display(Frame *frame);
     void video_open();
-    int upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx);
+    void window_open();
+    int upload_texture(SDL_Texture **tex, AVFrame *frame);
     int realloc_texture(SDL_Texture **texture, Uint32 new_format, int new_width, int new_height, SDL_BlendMode blendmode, int init_texture);
+    int create_renderer();
+    /**
+     * 显示vp并出队，同时记录queue/render延迟
+     * */
+    void present(Frame *vp);
+    /**
+     * 处理一个输入或自定义事件，请求退出时设置quit
+     * */
+    void handle_event(SDL_Event *event);
+    /**
+     * 不阻塞地处理所有已经到达的事件
+     * */
+    void pump_events();
+    /**
+     * 等待到deadline或者有新的frame，期间分段睡眠并处理事件
+     * */
+    void wait_until(int64_t deadline);
 
 public:
     Player(/* args */);
     int open(const char *filename, const AVInputFormat *iformat);
     void set_default_window_size(int width, int height, AVRational sar);
+    /**
+     * 主线程的渲染循环：按下一帧的显示时间精确睡眠，然后显示；
+     * 睡眠分段进行，段与段之间处理输入事件，输入不会等待解码
+     * */
+    void render_loop();
     void close();
     ~Player();
 };
@@ -0,0 +1,78 @@
+#ifndef _QUEUE_STATS_H
+#define _QUEUE_STATS_H
+
+extern "C"
+{
+#include <libavutil/time.h>
+#include <SDL2/SDL.h>
+}
+#include <atomic>
+
+/**
+ * 队列状态的快照，由各个原子计数器直接读取，不加锁
+ * */
+struct QueueStats
+{
+    int nb_items = 0;            //当前队列中的packet/frame个数
+    int max_nb_items = 0;        //个数的最高水位
+    int depth = 0;               //frame queue当前的深度
+    int64_t size = 0;            //当前缓存的字节数
+    int64_t max_size = 0;        //字节数的最高水位
+    double duration = 0;         //当前缓存的时长(秒)
+    double max_duration = 0;     //时长的最高水位(秒)
+    int64_t producer_waits = 0;  //生产者因队列已满在SDL_CondWait上阻塞的次数
+    int64_t producer_wait_us = 0;
+    int64_t consumer_waits = 0;  //消费者因队列为空在SDL_CondWait上阻塞的次数
+    int64_t consumer_wait_us = 0;
+    int64_t wakeups = 0;         //对等待方发出的SDL_CondSignal次数
+    int64_t dropped = 0;         //过载时丢弃的packet个数
+    int64_t dropped_gops = 0;    //过载时整个丢弃的GOP个数
+    int64_t pool_hits = 0;
+    int64_t pool_misses = 0;
+};
+
+/**
+ * 流水线中一个阶段的耗时统计，可以在任意线程无锁更新和读取
+ * */
+struct LatencyStats
+{
+    std::atomic<int64_t> count{0};
+    std::atomic<int64_t> total_us{0};
+    std::atomic<int64_t> max_us{0};
+
+    void add(int64_t us);
+};
+
+/**
+ * 更新最高水位
+ * */
+template <typename T>
+inline void update_high_water(std::atomic<T> &mark, T value)
+{
+    T cur = mark.load(std::memory_order_relaxed);
+    while (value > cur && !mark.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+inline void LatencyStats::add(int64_t us)
+{
+    count++;
+    total_us += us;
+    update_high_water(max_us, us);
+}
+
+/**
+ * SDL_CondWaitTimeout，同时统计阻塞的次数和时间。timeout_ms默认一直等待
+ * */
+inline int timed_cond_wait(SDL_cond *cond, SDL_mutex *mutex, std::atomic<int64_t> &waits, std::atomic<int64_t> &wait_us,
+                           Uint32 timeout_ms = SDL_MUTEX_MAXWAIT)
+{
+    int64_t start = av_gettime_relative();
+    int ret = SDL_CondWaitTimeout(cond, mutex, timeout_ms);
+    waits++;
+    wait_us += av_gettime_relative() - start;
+    return ret;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _SLICE_SCALER_H
+#define _SLICE_SCALER_H
+
+extern "C"
+{
+#include <libswscale/swscale.h>
+#include <libavutil/frame.h>
+#include <SDL2/SDL.h>
+#include "util.h"
+}
+
+#define SCALER_MAX_THREADS 16       //包括调用线程在内最多的线程数
+#define SCALER_MIN_SLICE_HEIGHT 64  //每个slice至少的行数，图像较小时减少slice
+#define SCALER_SLICE_ALIGN 16       //slice的起始行按这个值对齐，保证色度行与亮度行对应
+
+/**
+ * 多线程的像素格式转换：把图像按行切成水平的slice，每个slice有自己的SwsContext，
+ * 由线程池中的线程各自转换，调用线程也转换其中一个slice。
+ * SwsContext按像素格式和尺寸缓存，变化时才重建。只能在一个线程中调用scale
+ * */
+class SliceScaler
+{
+private:
+    struct Slice
+    {
+        struct SwsContext *ctx = NULL;
+        int y = 0; //起始行
+        int h = 0;
+    };
+    struct Worker
+    {
+        SliceScaler *scaler = NULL;
+        int index = 0; //负责的slice
+    };
+
+    int nb_threads = 1;
+    int flags = SWS_BICUBIC;
+    SDL_Thread *tids[SCALER_MAX_THREADS] = {NULL};
+    Worker workers[SCALER_MAX_THREADS];
+    SDL_mutex *mutex = NULL;
+    SDL_cond *work_cond = NULL; //有新的任务
+    SDL_cond *done_cond = NULL; //所有worker的slice都已经完成
+    int64_t generation = 0;     //每次scale加1，worker据此判断是否有新任务
+    int nb_pending = 0;         //还没有完成的worker个数
+    int abort_request = 0;
+
+    //当前的配置，变化时重建所有slice的SwsContext
+    Slice slices[SCALER_MAX_THREADS];
+    int nb_slices = 0;
+    int width = 0;
+    int height = 0;
+    enum AVPixelFormat src_format = AV_PIX_FMT_NONE;
+    enum AVPixelFormat dst_format = AV_PIX_FMT_NONE;
+
+    //当前的任务
+    const uint8_t *src_data[4] = {NULL};
+    int src_linesize[4] = {0};
+    uint8_t *dst_data[4] = {NULL};
+    int dst_linesize[4] = {0};
+
+    int configure(int width, int height, enum AVPixelFormat src_format, enum AVPixelFormat dst_format);
+    void scale_slice(int index);
+    void worker_loop(int index);
+    static int worker_thread(void *arg);
+
+public:
+    SliceScaler();
+    /**
+     * threads为包括调用线程在内的线程数，0表示按cpu核数自动选择；flags为SWS_*的缩放算法
+     * */
+    int init(int threads, int flags);
+    /**
+     * 把frame转换为dst_format写入dst，尺寸不变。所有slice都完成之后才返回
+     * */
+    int scale(AVFrame *frame, enum AVPixelFormat dst_format, uint8_t *dst[4], int dst_linesize[4]);
+    void destory();
+    ~SliceScaler();
+};
+
+#endif
@@ -4,6 +4,8 @@
 extern "C"
 {
 #include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
 #include <SDL2/SDL.h>
 }
 
@@ -30,6 +32,12 @@ const struct TextureFormatEntry {
     { AV_PIX_FMT_YUV420P,        SDL_PIXELFORMAT_IYUV },
     { AV_PIX_FMT_YUYV422,        SDL_PIXELFORMAT_YUY2 },
     { AV_PIX_FMT_UYVY422,        SDL_PIXELFORMAT_UYVY },
+    { AV_PIX_FMT_NV12,           SDL_PIXELFORMAT_NV12 },
+    { AV_PIX_FMT_NV21,           SDL_PIXELFORMAT_NV21 },
+    //下面的格式SDL不能直接显示，上传时降低位深或者色度采样(upload_texture_reduced)
+    { AV_PIX_FMT_P010,           SDL_PIXELFORMAT_NV12 },
+    { AV_PIX_FMT_YUV420P10,      SDL_PIXELFORMAT_IYUV },
+    { AV_PIX_FMT_YUV444P,        SDL_PIXELFORMAT_IYUV },
     { AV_PIX_FMT_NONE,           SDL_PIXELFORMAT_UNKNOWN },
 };
 
@@ -57,7 +65,9 @@ void set_sdl_yuv_conversion_mode(AVFrame *frame)
 {
 #if SDL_VERSION_ATLEAST(2,0,8)
     SDL_YUV_CONVERSION_MODE mode = SDL_YUV_CONVERSION_AUTOMATIC;
-    if (frame && (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUYV422 || frame->format == AV_PIX_FMT_UYVY422)) {
+    if (frame && (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUYV422 || frame->format == AV_PIX_FMT_UYVY422 ||
+                  frame->format == AV_PIX_FMT_NV12 || frame->format == AV_PIX_FMT_NV21 || frame->format == AV_PIX_FMT_P010 ||
+                  frame->format == AV_PIX_FMT_YUV420P10 || frame->format == AV_PIX_FMT_YUV444P)) {
         if (frame->color_range == AVCOL_RANGE_JPEG)
             mode = SDL_YUV_CONVERSION_JPEG;
         else if (frame->colorspace == AVCOL_SPC_BT709)
@@ -69,4 +79,118 @@ void set_sdl_yuv_conversion_mode(AVFrame *frame)
 #endif
 }
 
+/**
+ * 上传NV12/NV21，SDL 2.0.16之前没有SDL_UpdateNVTexture，锁定texture后按plane复制
+ * */
+int update_nv_texture(SDL_Texture *tex, const uint8_t *y, int y_pitch, const uint8_t *uv, int uv_pitch, int height)
+{
+#if SDL_VERSION_ATLEAST(2,0,16)
+    return SDL_UpdateNVTexture(tex, NULL, y, y_pitch, uv, uv_pitch);
+#else
+    uint8_t *pixels;
+    int pitch, w;
+    if (SDL_QueryTexture(tex, NULL, NULL, &w, NULL) < 0 || SDL_LockTexture(tex, NULL, (void **)&pixels, &pitch) < 0)
+    {
+        return -1;
+    }
+    av_image_copy_plane(pixels, pitch, y, y_pitch, w, height);
+    av_image_copy_plane(pixels + pitch * height, (pitch + 1) / 2 * 2, uv, uv_pitch, AV_CEIL_RSHIFT(w, 1) * 2, AV_CEIL_RSHIFT(height, 1));
+    SDL_UnlockTexture(tex);
+    return 0;
+#endif
+}
+
+/**
+ * 16bit的样本右移shift位转换为8bit：P010的有效位在高10位(shift=8)，YUV420P10在低10位(shift=2)。
+ * width为一行的样本数，负的src_linesize和其他上传路径一样按内存顺序复制，由显示时翻转
+ * */
+void reduce_plane_16_to_8(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_linesize, int width, int height, int shift)
+{
+    if (src_linesize < 0)
+    {
+        src += src_linesize * (height - 1);
+        src_linesize = -src_linesize;
+    }
+    for (int y = 0; y < height; y++)
+    {
+        const uint16_t *s = (const uint16_t *)(src + y * src_linesize);
+        uint8_t *d = dst + y * dst_pitch;
+        //简单的循环，编译器可以向量化
+        for (int x = 0; x < width; x++)
+        {
+            d[x] = (uint8_t)(s[x] >> shift);
+        }
+    }
+}
+
+/**
+ * 4:4:4的色度plane按2x2取平均降为4:2:0，width和height为源plane的大小
+ * */
+void decimate_plane_444_to_420(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_linesize, int width, int height)
+{
+    if (src_linesize < 0)
+    {
+        src += src_linesize * (height - 1);
+        src_linesize = -src_linesize;
+    }
+    for (int y = 0; y < AV_CEIL_RSHIFT(height, 1); y++)
+    {
+        const uint8_t *s0 = src + 2 * y * src_linesize;
+        const uint8_t *s1 = 2 * y + 1 < height ? s0 + src_linesize : s0;
+        uint8_t *d = dst + y * dst_pitch;
+        for (int x = 0; x < width >> 1; x++)
+        {
+            d[x] = (s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+        }
+        if (width & 1)
+        {
+            d[width >> 1] = (s0[width - 1] + s1[width - 1] + 1) >> 1;
+        }
+    }
+}
+
+/**
+ * 锁定texture后直接写入降低位深/色度采样之后的数据，不需要中间的缓存，也不经过swscale。
+ * texture为IYUV或NV12，锁定后的布局与SDL内部的YUV texture相同：Y plane之后依次为色度plane
+ * */
+int upload_texture_reduced(SDL_Texture *tex, AVFrame *frame)
+{
+    uint8_t *pixels;
+    int pitch;
+    int w = frame->width, h = frame->height;
+    int cw = AV_CEIL_RSHIFT(w, 1), ch = AV_CEIL_RSHIFT(h, 1);
+    if (SDL_LockTexture(tex, NULL, (void **)&pixels, &pitch) < 0)
+    {
+        return -1;
+    }
+    uint8_t *dst_y = pixels;
+    uint8_t *dst_c = pixels + pitch * h;
+    int cpitch = (pitch + 1) / 2;
+    switch (frame->format)
+    {
+    case AV_PIX_FMT_P010:
+        //输出NV12：UV交错存放，色度plane的pitch与Y相同
+        reduce_plane_16_to_8(dst_y, pitch, frame->data[0], frame->linesize[0], w, h, 8);
+        reduce_plane_16_to_8(dst_c, cpitch * 2, frame->data[1], frame->linesize[1], cw * 2, ch, 8);
+        break;
+    case AV_PIX_FMT_YUV420P10:
+        reduce_plane_16_to_8(dst_y, pitch, frame->data[0], frame->linesize[0], w, h, 2);
+        reduce_plane_16_to_8(dst_c, cpitch, frame->data[1], frame->linesize[1], cw, ch, 2);
+        reduce_plane_16_to_8(dst_c + cpitch * ch, cpitch, frame->data[2], frame->linesize[2], cw, ch, 2);
+        break;
+    case AV_PIX_FMT_YUV444P:
+        av_image_copy_plane(dst_y, pitch,
+                            frame->linesize[0] < 0 ? frame->data[0] + frame->linesize[0] * (h - 1) : frame->data[0],
+                            FFABS(frame->linesize[0]), w, h);
+        decimate_plane_444_to_420(dst_c, cpitch, frame->data[1], frame->linesize[1], w, h);
+        decimate_plane_444_to_420(dst_c + cpitch * ch, cpitch, frame->data[2], frame->linesize[2], w, h);
+        break;
+    default:
+        SDL_UnlockTexture(tex);
+        return -1;
+    }
+    SDL_UnlockTexture(tex);
+    return 0;
+}
+
 #endif
\ No newline at end of file
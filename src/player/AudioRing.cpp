@@ -0,0 +1,173 @@
+#include "AudioRing.h"
+extern "C"
+{
+#include <libavutil/mem.h>
+}
+
+AudioRing::AudioRing()
+{
+    logi("AudioRing::AudioRing()\n");
+}
+
+int AudioRing::init(int capacity, int frame_size, int bytes_per_sec)
+{
+    this->frame_size = FFMAX(frame_size, 1);
+    this->capacity = capacity - capacity % this->frame_size;
+    this->bytes_per_sec = bytes_per_sec;
+    if (this->capacity <= 0)
+    {
+        return AVERROR(EINVAL);
+    }
+    buf = (uint8_t *)av_malloc(this->capacity);
+    if (!buf)
+    {
+        logf("AudioRing::init Failed to alloc %d bytes.\n", this->capacity);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void AudioRing::copy_in(int64_t pos, const uint8_t *data, int len)
+{
+    int offset = (int)(pos % capacity);
+    int first = FFMIN(len, capacity - offset);
+    memcpy(buf + offset, data, first);
+    memcpy(buf, data + first, len - first);
+}
+
+void AudioRing::copy_out(int64_t pos, uint8_t *dst, int len)
+{
+    int offset = (int)(pos % capacity);
+    int first = FFMIN(len, capacity - offset);
+    memcpy(dst, buf + offset, first);
+    memcpy(dst + first, buf, len - first);
+}
+
+int AudioRing::write(const uint8_t *data, int len)
+{
+    int64_t w = wpos.load(std::memory_order_relaxed);
+    //acquire：消费者读取完之后这部分空间才能覆盖
+    int64_t r = rpos.load(std::memory_order_acquire);
+    int n = (int)FFMIN((int64_t)len, capacity - (w - r));
+    if (n <= 0)
+    {
+        return 0;
+    }
+    copy_in(w, data, n);
+    //release：数据写入完成之后才对消费者可见
+    wpos.store(w + n, std::memory_order_release);
+    update_high_water(max_fill, w + n - r);
+    return n;
+}
+
+void AudioRing::wait_space(int len, int max_wait_ms)
+{
+    int64_t need = FFMIN(len, capacity) - (capacity - fill());
+    if (need <= 0)
+    {
+        return;
+    }
+    int ms = bytes_per_sec > 0 ? (int)(need * 1000 / bytes_per_sec) : max_wait_ms;
+    int64_t start = av_gettime_relative();
+    //回调中不能发信号，生产者按消费的速度休眠
+    SDL_Delay(av_clip(ms, 1, max_wait_ms));
+    producer_waits++;
+    producer_wait_us += av_gettime_relative() - start;
+}
+
+int AudioRing::read(uint8_t *dst, int len)
+{
+    int64_t r = rpos.load(std::memory_order_relaxed);
+    int64_t f = flush_pos.load(std::memory_order_acquire);
+    if (f > r)
+    {
+        r = f;
+    }
+    int64_t w = wpos.load(std::memory_order_acquire);
+    int n = (int)FFMIN((int64_t)len, w - r);
+    n -= n % frame_size;
+    if (n > 0)
+    {
+        copy_out(r, dst, n);
+    }
+    rpos.store(r + n, std::memory_order_release);
+    if (n < len)
+    {
+        underruns++;
+    }
+    return n;
+}
+
+void AudioRing::set_clock_anchor(double pts, int serial)
+{
+    unsigned start = anchor_seq.load(std::memory_order_relaxed);
+    anchor_seq.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    anchor_pos.store(wpos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    anchor_pts.store(pts, std::memory_order_relaxed);
+    anchor_serial.store(serial, std::memory_order_relaxed);
+    anchor_seq.store(start + 2, std::memory_order_release);
+}
+
+int AudioRing::read_clock(double *pts, int *serial)
+{
+    unsigned start;
+    int64_t pos;
+    do
+    {
+        start = anchor_seq.load(std::memory_order_acquire);
+        pos = anchor_pos.load(std::memory_order_relaxed);
+        *pts = anchor_pts.load(std::memory_order_relaxed);
+        *serial = anchor_serial.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((start & 1) || start != anchor_seq.load(std::memory_order_relaxed));
+    if (isnan(*pts) || bytes_per_sec <= 0)
+    {
+        return 0;
+    }
+    //重采样后的数据是连续的，按字节数线性推算
+    *pts += (double)(rpos.load(std::memory_order_relaxed) - pos) / bytes_per_sec;
+    return 1;
+}
+
+void AudioRing::flush()
+{
+    flush_pos.store(wpos.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+int AudioRing::fill()
+{
+    int64_t r = FFMAX(rpos.load(std::memory_order_acquire), flush_pos.load(std::memory_order_acquire));
+    return (int)(wpos.load(std::memory_order_acquire) - r);
+}
+
+int AudioRing::get_bytes_per_sec()
+{
+    return bytes_per_sec;
+}
+
+void AudioRing::stats(QueueStats *stats)
+{
+    int64_t cur = fill();
+    stats->size = cur;
+    stats->max_size = max_fill;
+    if (bytes_per_sec > 0)
+    {
+        stats->duration = (double)cur / bytes_per_sec;
+        stats->max_duration = (double)stats->max_size / bytes_per_sec;
+    }
+    stats->producer_waits = producer_waits;
+    stats->producer_wait_us = producer_wait_us;
+    stats->consumer_waits = underruns;
+}
+
+void AudioRing::destory()
+{
+    av_freep(&buf);
+}
+
+AudioRing::~AudioRing()
+{
+    logi("AudioRing::~AudioRing()\n");
+    destory();
+}
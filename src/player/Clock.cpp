@@ -0,0 +1,93 @@
+#include "Clock.h"
+
+Clock::Clock()
+{
+}
+
+void Clock::init(PacketQueue *queue)
+{
+    this->queue = queue;
+    store(NAN, -1, av_gettime_relative() / 1000000.0, 1.0);
+}
+
+void Clock::snapshot(double *pts, double *pts_drift, double *last_updated, double *speed, int *serial)
+{
+    unsigned start;
+    do
+    {
+        start = seq.load(std::memory_order_acquire);
+        *pts = this->pts.load(std::memory_order_relaxed);
+        *pts_drift = this->pts_drift.load(std::memory_order_relaxed);
+        *last_updated = this->last_updated.load(std::memory_order_relaxed);
+        *speed = this->speed.load(std::memory_order_relaxed);
+        *serial = this->serial.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((start & 1) || start != seq.load(std::memory_order_relaxed));
+}
+
+double Clock::get()
+{
+    double pts, pts_drift, last_updated, speed;
+    int serial;
+    snapshot(&pts, &pts_drift, &last_updated, &speed, &serial);
+    if (queue && serial != queue->get_serial())
+    {
+        return NAN;
+    }
+    double time = av_gettime_relative() / 1000000.0;
+    return pts_drift + time - (time - last_updated) * (1.0 - speed);
+}
+
+void Clock::store(double pts, int serial, double time, double speed)
+{
+    unsigned start = seq.load(std::memory_order_relaxed);
+    seq.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->pts.store(pts, std::memory_order_relaxed);
+    this->last_updated.store(time, std::memory_order_relaxed);
+    this->pts_drift.store(pts - time, std::memory_order_relaxed);
+    this->serial.store(serial, std::memory_order_relaxed);
+    this->speed.store(speed, std::memory_order_relaxed);
+    seq.store(start + 2, std::memory_order_release);
+}
+
+void Clock::set_at(double pts, int serial, double time)
+{
+    store(pts, serial, time, speed.load(std::memory_order_relaxed));
+}
+
+void Clock::set(double pts, int serial)
+{
+    set_at(pts, serial, av_gettime_relative() / 1000000.0);
+}
+
+void Clock::set_speed(double speed)
+{
+    //先按原来的速度把时钟推进到当前时间，再改变速度
+    store(get(), get_serial(), av_gettime_relative() / 1000000.0, speed);
+}
+
+double Clock::get_speed()
+{
+    return speed;
+}
+
+int Clock::get_serial()
+{
+    return serial;
+}
+
+double Clock::get_last_updated()
+{
+    return last_updated;
+}
+
+void Clock::sync_to_slave(Clock *slave)
+{
+    double clock = get();
+    double slave_clock = slave->get();
+    if (!isnan(slave_clock) && (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD))
+    {
+        set(slave_clock, slave->get_serial());
+    }
+}
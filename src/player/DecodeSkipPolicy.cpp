@@ -0,0 +1,96 @@
+#include "DecodeSkipPolicy.h"
+
+DecodeSkipPolicy::DecodeSkipPolicy()
+{
+}
+
+void DecodeSkipPolicy::init(int max_level)
+{
+    this->max_level = av_clip(max_level, 0, DECODE_SKIP_MAX_LEVEL);
+    late_frames = 0;
+    ontime_frames = 0;
+    level = 0;
+}
+
+int DecodeSkipPolicy::update(double lateness, double frame_interval, int queue_starved)
+{
+    int cur = level;
+    if (isnan(lateness))
+    {
+        lateness = 0;
+    }
+    //落后超过一帧，或者显示已经在等待解码
+    if (lateness > FFMAX(frame_interval, 0.0) || (queue_starved && lateness > 0))
+    {
+        ontime_frames = 0;
+        if (++late_frames >= DECODE_SKIP_ESCALATE_FRAMES && cur < max_level)
+        {
+            late_frames = 0;
+            level = cur + 1;
+            update_high_water(max_level_seen, cur + 1);
+            changes++;
+            logw("DecodeSkipPolicy: decoding %.1fms behind, escalate to %s\n", lateness * 1000, level_name(cur + 1));
+            return 1;
+        }
+    }
+    else if (lateness < 0 && !queue_starved)
+    {
+        late_frames = 0;
+        if (++ontime_frames >= DECODE_SKIP_RELAX_FRAMES && cur > 0)
+        {
+            ontime_frames = 0;
+            level = cur - 1;
+            changes++;
+            logi("DecodeSkipPolicy: decoding caught up, relax to %s\n", level_name(cur - 1));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void DecodeSkipPolicy::set_min_level(int min_level)
+{
+    this->min_level = av_clip(min_level, 0, DECODE_SKIP_MAX_LEVEL);
+}
+
+void DecodeSkipPolicy::apply(AVCodecContext *avctx)
+{
+    int cur = FFMAX(level.load(), min_level.load());
+    avctx->skip_loop_filter = cur >= 2 ? AVDISCARD_ALL : cur >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    avctx->skip_idct = cur >= 3 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    avctx->skip_frame = cur >= 5 ? AVDISCARD_NONKEY : cur >= 4 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
+
+int DecodeSkipPolicy::get_level()
+{
+    return level;
+}
+
+int DecodeSkipPolicy::get_max_level_seen()
+{
+    return max_level_seen;
+}
+
+int64_t DecodeSkipPolicy::get_changes()
+{
+    return changes;
+}
+
+const char *DecodeSkipPolicy::level_name(int level)
+{
+    switch (level)
+    {
+    case 0:
+        return "full";
+    case 1:
+        return "skip nonref loop filter";
+    case 2:
+        return "skip loop filter";
+    case 3:
+        return "skip nonref idct";
+    case 4:
+        return "skip nonref frames";
+    default:
+        return "keyframes only";
+    }
+}
@@ -1,4 +1,8 @@
 #include "Decoder.h"
+extern "C"
+{
+#include <libavutil/time.h>
+}
 
 Decoder::Decoder(/* args */)
 {
@@ -40,76 +44,156 @@ int Decoder::start(int (*fn)(void *), const char *thread_name, void *arg)
 void Decoder::abort()
 {
     pkt_queue->abort();    //终止packet queue队列
-    frame_queue->signal(); //唤醒帧队列，以便队列中的frame能够显示出来
+    if (frame_queue)
+    {
+        frame_queue->signal(); //唤醒帧队列，以便队列中的frame能够显示出来
+    }
     SDL_WaitThread(decoder_tid, NULL);
     decoder_tid = NULL;
     pkt_queue->flush(); //清空队列
+    release_pending_nodes();
+}
+
+void Decoder::release_pending_nodes()
+{
+    for (; pending_node_index < nb_pending_nodes; pending_node_index++)
+    {
+        pkt_queue->release(pending_nodes[pending_node_index]);
+    }
+    nb_pending_nodes = 0;
+    pending_node_index = 0;
+}
+
+int Decoder::get_pkt_serial()
+{
+    return pkt_serial;
+}
+
+int Decoder::is_finished()
+{
+    return finished;
+}
+
+int64_t Decoder::get_wait_us()
+{
+    return wait_us;
+}
+
+void Decoder::set_skip_policy(DecodeSkipPolicy *policy)
+{
+    skip_policy = policy;
+    if (skip_policy)
+    {
+        skip_policy->apply(avctx);
+    }
+}
+
+void Decoder::update_skip_policy(double lateness, double frame_interval, int queue_starved)
+{
+    if (skip_policy && skip_policy->update(lateness, frame_interval, queue_starved))
+    {
+        skip_policy->apply(avctx);
+    }
 }
 
 int Decoder::decode_frame(AVFrame *frame)
 {
     int ret = AVERROR(EAGAIN); //当前状态不对，读取的帧不行 output is not available in this state - user must try to send new input
+    wait_us = 0;
     for (;;)
     {
-        do
+        //packet的serial与队列不一致时，解码器中的数据都已过期，不再读取frame
+        if (pkt_serial == pkt_queue->get_serial())
         {
-            //检查退出位
-            if (pkt_queue->isAbort())
-            {
-                return -1;
-            }
-            switch (avctx->codec_type)
+            do
             {
-            case AVMEDIA_TYPE_VIDEO:
-                ret = avcodec_receive_frame(avctx, frame);
-                break;
-            case AVMEDIA_TYPE_AUDIO:
-                ret = avcodec_receive_frame(avctx, frame);
-                if (ret >= 0)
+                //检查退出位
+                if (pkt_queue->isAbort())
+                {
+                    return -1;
+                }
+                switch (avctx->codec_type)
                 {
-                    AVRational tb = (AVRational){1, frame->sample_rate};
-                    if (frame->pts != AV_NOPTS_VALUE)
-                        frame->pts = av_rescale_q(frame->pts, avctx->pkt_timebase, tb);
-                    else if (next_pts != AV_NOPTS_VALUE)
-                        frame->pts = av_rescale_q(next_pts, next_pts_tb, tb);
-                    if (frame->pts != AV_NOPTS_VALUE)
+                case AVMEDIA_TYPE_VIDEO:
+                    ret = avcodec_receive_frame(avctx, frame);
+                    break;
+                case AVMEDIA_TYPE_AUDIO:
+                    ret = avcodec_receive_frame(avctx, frame);
+                    if (ret >= 0)
                     {
-                        next_pts = frame->pts + frame->nb_samples;
-                        next_pts_tb = tb;
+                        AVRational tb = (AVRational){1, frame->sample_rate};
+                        if (frame->pts != AV_NOPTS_VALUE)
+                            frame->pts = av_rescale_q(frame->pts, avctx->pkt_timebase, tb);
+                        else if (next_pts != AV_NOPTS_VALUE)
+                            frame->pts = av_rescale_q(next_pts, next_pts_tb, tb);
+                        if (frame->pts != AV_NOPTS_VALUE)
+                        {
+                            next_pts = frame->pts + frame->nb_samples;
+                            next_pts_tb = tb;
+                        }
                     }
+                    break;
                 }
-                break;
-            }
-            //读取到末尾了
-            if (ret == AVERROR_EOF)
-            {
-                finished = 1;
-                avcodec_flush_buffers(avctx);
-                return 0;
-            }
-            if (ret >= 0)
-            {
-                return 1;
-            }
-        } while (ret != AVERROR(EAGAIN)); //这个循环，从codec_ctx中读取出可用的frame
-
-        if (packet_pending)
-        {
-            packet_pending = 0;
+                //读取到末尾了
+                if (ret == AVERROR_EOF)
+                {
+                    finished = 1;
+                    avcodec_flush_buffers(avctx);
+                    return 0;
+                }
+                if (ret >= 0)
+                {
+                    return 1;
+                }
+            } while (ret != AVERROR(EAGAIN)); //这个循环，从codec_ctx中读取出可用的frame
         }
-        else
+
+        do
         {
-            auto *packetList = pkt_queue->get(1);
-            if (!packetList)
+            if (packet_pending)
             {
-                return -1;
+                packet_pending = 0;
             }
             else
             {
+                int old_serial = pkt_serial;
+                //本地的一批packet已经用完，一次从队列中取出多个
+                if (pending_node_index >= nb_pending_nodes)
+                {
+                    int64_t wait_start = av_gettime_relative();
+                    int n = pkt_queue->get_batch(pending_nodes, DECODER_PACKET_BATCH, 1);
+                    wait_us += av_gettime_relative() - wait_start;
+                    if (n <= 0)
+                    {
+                        return -1;
+                    }
+                    nb_pending_nodes = n;
+                    pending_node_index = 0;
+                }
+                auto *packetList = pending_nodes[pending_node_index++];
                 av_packet_move_ref(pkt, packetList->pkt); //使用pkt来暂存读取到的packet数据
-                delete packetList;
+                pkt_serial = packetList->serial;
+                pkt_queue->release(packetList);
+                //serial变化说明发生了seek，丢弃解码器中缓存的数据
+                if (old_serial != pkt_serial)
+                {
+                    avcodec_flush_buffers(avctx);
+                    finished = 0;
+                    next_pts = start_pts;
+                    next_pts_tb = start_pts_tb;
+                    //倍速播放切换只解码关键帧时伴随着seek，在这里生效
+                    if (skip_policy)
+                    {
+                        skip_policy->apply(avctx);
+                    }
+                }
             }
-        }
+            if (pkt_serial == pkt_queue->get_serial())
+            {
+                break;
+            }
+            av_packet_unref(pkt); //过期的packet直接丢弃
+        } while (1);
 
         if (avcodec_send_packet(avctx, pkt) == AVERROR(EAGAIN)) //证明avctx中还有frame可以读取
         {
@@ -125,6 +209,7 @@ int Decoder::decode_frame(AVFrame *frame)
 
 void Decoder::destory()
 {
+    release_pending_nodes();
     av_packet_free(&pkt);
     avcodec_free_context(&avctx);
 }
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include "FramePool.h"
+extern "C"
+{
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+FramePool::FramePool()
+{
+    logi("FramePool::FramePool()\n");
+}
+
+int FramePool::init()
+{
+    mutex = SDL_CreateMutex();
+    if (!mutex)
+    {
+        logf("FramePool::init SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void FramePool::attach(AVCodecContext *codec_ctx, const AVCodec *codec)
+{
+    if (!(codec->capabilities & AV_CODEC_CAP_DR1))
+    {
+        return;
+    }
+    codec_ctx->opaque = this;
+    codec_ctx->get_buffer2 = FramePool::get_buffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+    //get_buffer加了锁，frame多线程解码时可以直接在解码线程中调用，不需要回到主解码线程
+    codec_ctx->thread_safe_callbacks = 1;
+#endif
+}
+
+AVBufferRef *FramePool::alloc_aligned(void *opaque, int size)
+{
+    FramePool *pool = (FramePool *)opaque;
+    void *data = NULL;
+    AVBufferRef *buf;
+    if (posix_memalign(&data, FRAME_POOL_ALIGN, size))
+    {
+        return NULL;
+    }
+    buf = av_buffer_create((uint8_t *)data, size, free_aligned, NULL, 0);
+    if (!buf)
+    {
+        free(data);
+        return NULL;
+    }
+    pool->nb_allocs++;
+    return buf;
+}
+
+void FramePool::free_aligned(void *opaque, uint8_t *data)
+{
+    free(data);
+}
+
+void FramePool::release_pools()
+{
+    //还在使用中的buffer归还之后才会真正释放
+    for (int i = 0; i < 4; i++)
+    {
+        av_buffer_pool_uninit(&pools[i]);
+    }
+}
+
+int FramePool::rebuild(AVCodecContext *avctx, int width, int height, int format)
+{
+    uint8_t *data[4];
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int size[4] = {0};
+    int w = width, h = height;
+    int unaligned, total, i;
+
+    release_pools();
+    this->format = AV_PIX_FMT_NONE;
+
+    //与libavcodec默认的分配方式一样，按解码器的要求对齐宽高，并保证每个plane的linesize都是64的倍数
+    avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+    do
+    {
+        total = av_image_fill_linesizes(linesize, (AVPixelFormat)format, w);
+        if (total < 0)
+        {
+            return total;
+        }
+        w += w & ~(w - 1);
+        unaligned = 0;
+        for (i = 0; i < 4; i++)
+        {
+            unaligned |= linesize[i] % FRAME_POOL_ALIGN;
+        }
+    } while (unaligned);
+
+    total = av_image_fill_pointers(data, (AVPixelFormat)format, h, NULL, linesize);
+    if (total < 0)
+    {
+        return total;
+    }
+    for (i = 0; i < 3 && data[i + 1]; i++)
+    {
+        size[i] = (int)(data[i + 1] - data[i]);
+    }
+    size[i] = total - (int)(data[i] - data[0]);
+
+    for (i = 0; i < 4 && size[i]; i++)
+    {
+        pools[i] = av_buffer_pool_init2(size[i] + 16 + FRAME_POOL_ALIGN - 1, this, alloc_aligned, NULL);
+        if (!pools[i])
+        {
+            release_pools();
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    this->width = width;
+    this->height = height;
+    this->format = format;
+    logi("FramePool: rebuilt for %dx%d %s\n", width, height, av_get_pix_fmt_name((AVPixelFormat)format));
+    return 0;
+}
+
+int FramePool::get_buffer(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    int ret = 0;
+    int i;
+    //音频、调色板和硬件格式仍然使用默认的分配方式
+    if (avctx->codec_type != AVMEDIA_TYPE_VIDEO || !desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)))
+    {
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    }
+
+    SDL_LockMutex(mutex);
+    if (frame->width != width || frame->height != height || frame->format != format)
+    {
+        ret = rebuild(avctx, frame->width, frame->height, frame->format);
+        if (ret < 0)
+        {
+            SDL_UnlockMutex(mutex);
+            return ret;
+        }
+    }
+
+    for (i = 0; i < 4 && pools[i]; i++)
+    {
+        frame->buf[i] = av_buffer_pool_get(pools[i]);
+        if (!frame->buf[i])
+        {
+            SDL_UnlockMutex(mutex);
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesize[i];
+    }
+    SDL_UnlockMutex(mutex);
+
+    for (; i < AV_NUM_DATA_POINTERS; i++)
+    {
+        frame->data[i] = NULL;
+        frame->linesize[i] = 0;
+    }
+    frame->extended_data = frame->data;
+    nb_gets++;
+    return 0;
+}
+
+void FramePool::trim()
+{
+    SDL_LockMutex(mutex);
+    if (format != AV_PIX_FMT_NONE)
+    {
+        //空闲的buffer立即释放，还在使用的等到旧pool的buffer全部归还之后释放
+        release_pools();
+        format = AV_PIX_FMT_NONE;
+        nb_trims++;
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+int FramePool::get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+    FramePool *pool = (FramePool *)avctx->opaque;
+    return pool->get_buffer(avctx, frame, flags);
+}
+
+void FramePool::destory()
+{
+    release_pools();
+    if (mutex)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = NULL;
+    }
+    logi("FramePool: %lld frames, %lld buffers allocated, %lld trims\n", (long long)nb_gets, (long long)nb_allocs, (long long)nb_trims);
+}
+
+FramePool::~FramePool()
+{
+    logi("FramePool::~FramePool()\n");
+    destory();
+}
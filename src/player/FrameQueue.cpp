@@ -10,9 +10,14 @@ FrameQueue::FrameQueue()
     logi("FrameQueue::FrameQueue()\n");
 }
 
-int FrameQueue::init(uint max_size, PacketQueue *pktq)
+int FrameQueue::init(int depth, PacketQueue *pktq, int max_depth)
 {
-    this->max_size = max_size;
+    depth = av_clip(depth, 1, FRAME_QUEUE_MAX_SIZE);
+    max_depth = av_clip(max_depth, depth, FRAME_QUEUE_MAX_SIZE);
+    this->depth = depth;
+    this->min_depth = depth;
+    this->max_depth = max_depth;
+    this->max_size = max_depth;
     frames = new Frame[max_size]();
     if (!frames)
     {
@@ -20,7 +25,7 @@ int FrameQueue::init(uint max_size, PacketQueue *pktq)
         return AVERROR(ENOMEM);
     }
 
-    for (size_t i = 0; i < max_size; i++)
+    for (int i = 0; i < max_size; i++)
     {
         if (!frames[i].init())
         {
@@ -55,6 +60,18 @@ bool FrameQueue::is_empty(){
     return size == 0;
 }
 
+void FrameQueue::stats(QueueStats *stats)
+{
+    stats->nb_items = size;
+    stats->max_nb_items = max_size_seen;
+    stats->depth = depth;
+    stats->producer_waits = producer_waits;
+    stats->producer_wait_us = producer_wait_us;
+    stats->consumer_waits = consumer_waits;
+    stats->consumer_wait_us = consumer_wait_us;
+    stats->wakeups = wakeups;
+}
+
 void FrameQueue::destory()
 {
     delete[] frames;
@@ -62,22 +79,69 @@ void FrameQueue::destory()
     SDL_DestroyMutex(mutex);
 }
 
-Frame *FrameQueue::get()
+void FrameQueue::set_wakeup_thresholds(int consumer_wake_threshold, int producer_wake_space, int max_delay_ms)
+{
+    this->consumer_wake_threshold = FFMAX(consumer_wake_threshold, 1);
+    this->producer_wake_space = FFMAX(producer_wake_space, 1);
+    wake_max_delay_ms = FFMAX(max_delay_ms, 1);
+}
+
+void FrameQueue::wake(std::atomic<int> &waiting, int ready)
 {
-    auto *frame = peekReadable();
-    if (!frame)
+    //size的修改必须在读取waiting之前对另一方可见，否则可能丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ready && waiting.load(std::memory_order_relaxed))
     {
-        return NULL;
+        SDL_LockMutex(mutex);
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+        wakeups++;
     }
-    SDL_LockMutex(mutex);
+}
+
+int FrameQueue::adapt_depth(double decode_time, double frame_interval)
+{
+    int cur = depth;
+    if (max_depth <= min_depth || frame_interval <= 0)
+    {
+        return 0;
+    }
+    if (decode_time > frame_interval)
+    {
+        //解码抖动，增加缓冲
+        steady_frames = 0;
+        if (cur < max_depth)
+        {
+            depth = cur + 1;
+            logd("FrameQueue::adapt_depth grow to %d, decode %.1fms > interval %.1fms\n", cur + 1, decode_time * 1000, frame_interval * 1000);
+            return 1;
+        }
+    }
+    else if (decode_time < frame_interval / 2)
+    {
+        //解码稳定，减少缓存的frame以节省内存
+        if (++steady_frames >= FRAME_QUEUE_SHRINK_FRAMES && cur > min_depth)
+        {
+            depth = cur - 1;
+            steady_frames = 0;
+            logd("FrameQueue::adapt_depth shrink to %d\n", cur - 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void FrameQueue::next()
+{
+    av_frame_unref(frames[rindex].frame);
     if (++rindex >= max_size)
     {
         rindex = 0;
     }
-    size--;
-    SDL_CondSignal(cond);
-    SDL_UnlockMutex(mutex);
-    return frame;
+    //release：frame中的数据读取完之后才把位置归还给生产者
+    int left = size.fetch_sub(1, std::memory_order_release) - 1;
+    //空出足够的位置才唤醒等待写入的解码线程
+    wake(producer_waiting, depth - left >= producer_wake_space);
 }
 
 Frame *FrameQueue::peek()
@@ -90,15 +154,45 @@ Frame *FrameQueue::peekLast()
     return &frames[rindex];
 }
 
+Frame *FrameQueue::peekNext()
+{
+    return &frames[(rindex + rindex_shown + 1) % max_size];
+}
+
+int FrameQueue::nb_remaining()
+{
+    return size.load(std::memory_order_acquire) - rindex_shown;
+}
+
 Frame *FrameQueue::peekReadable()
 {
-    //wait until we have a readable frame
-    SDL_LockMutex(mutex);
-    while (size - rindex_shown <= 0 && !pktq->isAbort())
+    return peek_until(INT64_MAX);
+}
+
+Frame *FrameQueue::peek_until(int64_t deadline)
+{
+    //wait until we have a readable frame or the deadline has passed
+    while (size.load(std::memory_order_acquire) - rindex_shown <= 0 && !pktq->isAbort())
     {
-        SDL_CondWait(cond, mutex);
+        Uint32 timeout = consumer_wake_threshold > 1 ? (Uint32)wake_max_delay_ms : SDL_MUTEX_MAXWAIT;
+        if (deadline != INT64_MAX)
+        {
+            int64_t remaining = deadline - av_gettime_relative();
+            if (remaining <= 0)
+            {
+                return NULL;
+            }
+            timeout = FFMIN(timeout, (Uint32)((remaining + 999) / 1000));
+        }
+        SDL_LockMutex(mutex);
+        consumer_waiting.store(1);
+        if (size.load() - rindex_shown <= 0 && !pktq->isAbort())
+        {
+            timed_cond_wait(cond, mutex, consumer_waits, consumer_wait_us, timeout);
+        }
+        consumer_waiting.store(0);
+        SDL_UnlockMutex(mutex);
     }
-    SDL_UnlockMutex(mutex);
     if (pktq->isAbort())
     {
         return NULL;
@@ -109,12 +203,18 @@ Frame *FrameQueue::peekReadable()
 Frame *FrameQueue::peekWritable()
 {
     //wait until wa have a writable frame space
-    SDL_LockMutex(mutex);
-    while (!pktq->isAbort() && size >= max_size)
+    while (!pktq->isAbort() && size.load(std::memory_order_acquire) >= depth)
     {
-        SDL_CondWait(cond, mutex);
+        SDL_LockMutex(mutex);
+        producer_waiting.store(1);
+        if (!pktq->isAbort() && size.load() >= depth)
+        {
+            timed_cond_wait(cond, mutex, producer_waits, producer_wait_us,
+                            producer_wake_space > 1 ? (Uint32)wake_max_delay_ms : SDL_MUTEX_MAXWAIT);
+        }
+        producer_waiting.store(0);
+        SDL_UnlockMutex(mutex);
     }
-    SDL_UnlockMutex(mutex);
     if (pktq->isAbort())
     {
         return NULL;
@@ -122,58 +222,38 @@ Frame *FrameQueue::peekWritable()
     return &frames[windex];
 }
 
-Frame *FrameQueue::put(Frame *frame)
+Frame *FrameQueue::put(AVFrame *frame, double duration, double pts, int64_t pos, int serial)
 {
     auto *wFrame = peekWritable();
     if (!wFrame)
     {
         return NULL;
     }
-    wFrame->copy(frame);
-    delete frame; //释放传进来的frame空间
-    SDL_LockMutex(mutex);
-    if (++windex >= max_size)
-    {
-        windex = 0;
-    }
-    size++;
-    SDL_CondSignal(cond);
-    SDL_UnlockMutex(mutex);
+    av_frame_move_ref(wFrame->frame, frame);
+    wFrame->set_props(duration, pts, pos, serial);
+
+    commit();
     return wFrame;
 }
 
-Frame *FrameQueue::put(AVFrame *frame, int duration, double pts, int64_t pos)
+void FrameQueue::commit()
 {
-    auto *wFrame = peekWritable();
-    if (!wFrame)
-    {
-        return NULL;
-    }
-    wFrame->width = frame->width;
-    wFrame->height = frame->height;
-    wFrame->format = frame->format;
-    wFrame->sar = frame->sample_aspect_ratio;
-    wFrame->duration = duration;
-    wFrame->pts = pts;
-    wFrame->pos = pos;
-
-    av_frame_move_ref(wFrame->frame, frame);
-
-    SDL_LockMutex(mutex);
+    frames[windex].commit_time = av_gettime_relative();
     if (++windex >= max_size)
     {
         windex = 0;
     }
-    size++;
-    SDL_CondSignal(cond);
-    SDL_UnlockMutex(mutex);
-    return wFrame;
+    //release：frame写入完成之后才对消费者可见
+    int count = size.fetch_add(1, std::memory_order_release) + 1;
+    update_high_water(max_size_seen, count);
+    //积攒到足够的frame，或者队列已满(解码线程接下来会等待)时唤醒消费者
+    wake(consumer_waiting, count >= consumer_wake_threshold || count >= depth);
 }
 
 void FrameQueue::signal()
 {
     SDL_LockMutex(mutex);
-    SDL_CondSignal(cond);
+    SDL_CondBroadcast(cond);
     SDL_UnlockMutex(mutex);
 }
 
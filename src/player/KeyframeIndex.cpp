@@ -0,0 +1,67 @@
+#include "KeyframeIndex.h"
+#include <algorithm>
+
+static bool entry_before(const KeyframeEntry &entry, int64_t pts)
+{
+    return entry.pts < pts;
+}
+
+static bool entry_after(int64_t pts, const KeyframeEntry &entry)
+{
+    return pts < entry.pts;
+}
+
+KeyframeIndex::KeyframeIndex()
+{
+}
+
+void KeyframeIndex::add(int64_t pts, int64_t pos)
+{
+    if (pts == AV_NOPTS_VALUE)
+    {
+        last_pts = AV_NOPTS_VALUE;
+        return;
+    }
+    //顺序播放时总是追加在末尾
+    auto it = std::lower_bound(entries.begin(), entries.end(), pts, entry_before);
+    if (it == entries.end() || it->pts != pts)
+    {
+        KeyframeEntry entry;
+        entry.pts = pts;
+        entry.pos = pos;
+        it = entries.insert(it, entry);
+    }
+    //和上一个关键帧是连续读取到的，它们之间没有别的关键帧
+    if (last_pts != AV_NOPTS_VALUE && it != entries.begin() && (it - 1)->pts == last_pts)
+    {
+        (it - 1)->has_next = 1;
+    }
+    last_pts = pts;
+}
+
+int KeyframeIndex::lookup(int64_t ts, KeyframeEntry *entry)
+{
+    auto it = std::upper_bound(entries.begin(), entries.end(), ts, entry_after);
+    if (it == entries.begin())
+    {
+        return 0;
+    }
+    --it;
+    //不知道后面是否还有更近的关键帧时交给demuxer搜索
+    if (!it->has_next)
+    {
+        return 0;
+    }
+    *entry = *it;
+    return 1;
+}
+
+void KeyframeIndex::new_run()
+{
+    last_pts = AV_NOPTS_VALUE;
+}
+
+int KeyframeIndex::size()
+{
+    return (int)entries.size();
+}
@@ -1,12 +1,73 @@
 #include "PacketQueue.h"
 #include <iostream>
+extern "C"
+{
+#include "nalu.h"
+}
+
+/**
+ * H.264的packet中所有slice的nal_ref_idc都为NALU_PRIORITY_DISPOSABLE时，该packet不会被其他帧参考
+ * */
+static int h264_packet_is_disposable(const uint8_t *data, int size, int nal_length_size)
+{
+    const uint8_t *p = data, *end = data + size;
+    const uint8_t *nal;
+    int nb_slices = 0;
+    //packet以起始码开头时按Annex B解析
+    if (size >= 3 && data[0] == 0 && data[1] == 0 && (data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1)))
+    {
+        nal_length_size = 0;
+    }
+    while (end - p > nal_length_size)
+    {
+        if (nal_length_size)
+        {
+            uint32_t len = 0;
+            for (int i = 0; i < nal_length_size; i++)
+            {
+                len = (len << 8) | p[i];
+            }
+            nal = p + nal_length_size;
+            if (len == 0 || len > (uint32_t)(end - nal))
+            {
+                break;
+            }
+            p = nal + len;
+        }
+        else
+        {
+            //查找下一个起始码0x000001
+            while (end - p >= 3 && !(p[0] == 0 && p[1] == 0 && p[2] == 1))
+            {
+                p++;
+            }
+            if (end - p < 4)
+            {
+                break;
+            }
+            nal = p + 3;
+            p = nal;
+        }
+        int type = nal[0] & 0x1f;
+        int ref_idc = (nal[0] >> 5) & 0x03;
+        if (type >= NALU_TYPE_SLICE && type <= NALU_TYPE_IDR)
+        {
+            if (ref_idc != NALU_PRIORITY_DISPOSABLE)
+            {
+                return 0;
+            }
+            nb_slices++;
+        }
+    }
+    return nb_slices > 0;
+}
 
 PacketQueue::PacketQueue()
 {
     std::cout << "init packet queue" << std::endl;
 }
 
-int PacketQueue::init()
+int PacketQueue::init(int spsc_capacity)
 {
     mutex = SDL_CreateMutex();
     if (!mutex)
@@ -20,11 +81,35 @@ int PacketQueue::init()
         logf("SDL_CreateCond(): %s\n", SDL_GetError());
         return AVERROR(ENOMEM);
     }
-    packet_list = av_fifo_alloc(sizeof(MyAVPacketList));
+    packet_list = av_fifo_alloc(sizeof(MyAVPacketList *));
     if (!packet_list)
     {
         return AVERROR(ENOMEM);
     }
+    if (spsc_capacity > 0)
+    {
+        ring_size = 1;
+        while (ring_size < (unsigned)spsc_capacity)
+        {
+            ring_size <<= 1;
+        }
+        ring = (AVPacket **)av_mallocz_array(ring_size, sizeof(AVPacket *));
+        ring_serials = (int *)av_mallocz_array(ring_size, sizeof(int));
+        if (!ring || !ring_serials)
+        {
+            return AVERROR(ENOMEM);
+        }
+        for (unsigned i = 0; i < ring_size; i++)
+        {
+            ring[i] = av_packet_alloc();
+            if (!ring[i])
+            {
+                return AVERROR(ENOMEM);
+            }
+        }
+        ring_rindex = 0;
+        ring_windex = 0;
+    }
     abort_request = 1;
     duration = 0;
     size = 0;
@@ -32,11 +117,374 @@ int PacketQueue::init()
     return 0;
 }
 
+MyAVPacketList *PacketQueue::pool_acquire()
+{
+    MyAVPacketList *node;
+    SDL_AtomicLock(&pool_lock);
+    node = free_list;
+    if (node)
+    {
+        free_list = node->next;
+    }
+    SDL_AtomicUnlock(&pool_lock);
+    if (node)
+    {
+        pool_hits++;
+        node->next = NULL;
+        return node;
+    }
+
+    pool_misses++;
+    node = new MyAVPacketList();
+    if (node->init() < 0)
+    {
+        delete node;
+        return NULL;
+    }
+    return node;
+}
+
+void PacketQueue::release(MyAVPacketList *node)
+{
+    if (!node)
+    {
+        return;
+    }
+    av_packet_unref(node->pkt);
+    SDL_AtomicLock(&pool_lock);
+    node->next = free_list;
+    free_list = node;
+    SDL_AtomicUnlock(&pool_lock);
+}
+
+void PacketQueue::pool_stats(int64_t *hits, int64_t *misses)
+{
+    *hits = pool_hits;
+    *misses = pool_misses;
+}
+
+void PacketQueue::set_limits(int max_bytes, double max_seconds, AVRational time_base)
+{
+    this->max_bytes = max_bytes;
+    this->time_base = time_base;
+    max_duration = max_seconds > 0 ? (int64_t)(max_seconds / av_q2d(time_base)) : 0;
+}
+
+void PacketQueue::set_wakeup_thresholds(int consumer_wake_threshold, int producer_wake_space, int max_delay_ms)
+{
+    this->consumer_wake_threshold = FFMAX(consumer_wake_threshold, 1);
+    this->producer_wake_space = FFMAX(producer_wake_space, 1);
+    wake_max_delay_ms = FFMAX(max_delay_ms, 1);
+}
+
+Uint32 PacketQueue::consumer_wait_timeout()
+{
+    return consumer_wake_threshold > 1 ? (Uint32)wake_max_delay_ms : SDL_MUTEX_MAXWAIT;
+}
+
+Uint32 PacketQueue::producer_wait_timeout()
+{
+    return producer_wake_space > 1 ? (Uint32)wake_max_delay_ms : SDL_MUTEX_MAXWAIT;
+}
+
+void PacketQueue::set_overload_policy(double latency_budget, AVCodecParameters *codecpar)
+{
+    this->latency_budget = latency_budget;
+    codec_id = codecpar->codec_id;
+    nal_length_size = 0;
+    //avcC: extradata[0]为1，lengthSizeMinusOne在extradata[4]的低2位
+    if (codec_id == AV_CODEC_ID_H264 && codecpar->extradata_size >= 7 && codecpar->extradata[0] == 1)
+    {
+        nal_length_size = (codecpar->extradata[4] & 0x03) + 1;
+    }
+}
+
+int PacketQueue::is_disposable(AVPacket *pkt)
+{
+    if (pkt->flags & AV_PKT_FLAG_KEY)
+    {
+        return 0;
+    }
+    if (pkt->flags & AV_PKT_FLAG_DISPOSABLE)
+    {
+        return 1;
+    }
+    if (codec_id == AV_CODEC_ID_H264)
+    {
+        return h264_packet_is_disposable(pkt->data, pkt->size, nal_length_size);
+    }
+    return 0;
+}
+
+int PacketQueue::overload_drop(AVPacket *pkt)
+{
+    double latency;
+    if (latency_budget <= 0 || !pkt->data || !time_base.num)
+    {
+        return 0;
+    }
+    latency = duration * av_q2d(time_base);
+
+    if (skip_to_keyframe)
+    {
+        if (!(pkt->flags & AV_PKT_FLAG_KEY))
+        {
+            dropped++;
+            av_packet_unref(pkt);
+            return 1;
+        }
+        //到达关键帧，队列中仍然积压过多时丢弃这个关键帧之前还在队列中的packet，解码从这个关键帧继续。
+        //serial不变，已经解码出来的frame和时钟都不受影响，不会被当作seek
+        skip_to_keyframe = 0;
+        if (latency > latency_budget)
+        {
+            drop_before.store(put_count, std::memory_order_release);
+        }
+        dropped_gops++;
+        return 0;
+    }
+
+    if (latency > 2 * latency_budget && !(pkt->flags & AV_PKT_FLAG_KEY))
+    {
+        skip_to_keyframe = 1;
+        dropped++;
+        av_packet_unref(pkt);
+        return 1;
+    }
+    if (latency > latency_budget && is_disposable(pkt))
+    {
+        dropped++;
+        av_packet_unref(pkt);
+        return 1;
+    }
+    return 0;
+}
+
+void PacketQueue::stats(QueueStats *stats)
+{
+    double tb = time_base.num ? av_q2d(time_base) : 0;
+    stats->nb_items = nb_packets;
+    stats->max_nb_items = max_nb_packets;
+    stats->size = size;
+    stats->max_size = max_size;
+    stats->duration = duration * tb;
+    stats->max_duration = max_duration_seen * tb;
+    stats->producer_waits = producer_waits;
+    stats->producer_wait_us = producer_wait_us;
+    stats->consumer_waits = consumer_waits;
+    stats->consumer_wait_us = consumer_wait_us;
+    stats->wakeups = wakeups;
+    stats->dropped = dropped;
+    stats->dropped_gops = dropped_gops;
+    stats->pool_hits = pool_hits;
+    stats->pool_misses = pool_misses;
+}
+
+void PacketQueue::set_continue_cond(SDL_mutex *mutex, SDL_cond *cond)
+{
+    continue_mutex = mutex;
+    continue_cond = cond;
+}
+
+int PacketQueue::has_enough()
+{
+    return (max_bytes > 0 && size >= max_bytes) ||
+           (max_duration > 0 && duration >= max_duration);
+}
+
+int PacketQueue::is_empty()
+{
+    return nb_packets <= 0;
+}
+
+void PacketQueue::signal_continue()
+{
+    if (continue_cond)
+    {
+        SDL_LockMutex(continue_mutex);
+        SDL_CondSignal(continue_cond);
+        SDL_UnlockMutex(continue_mutex);
+    }
+}
+
+void PacketQueue::account_added(AVPacket *pkt)
+{
+    put_count++;
+    update_high_water(max_nb_packets, ++nb_packets);
+    update_high_water(max_size, size += pkt->size + sizeof(MyAVPacketList));
+    update_high_water(max_duration_seen, duration += pkt->duration);
+}
+
+int PacketQueue::account_removed(AVPacket *pkt)
+{
+    int stale = get_count++ < drop_before.load(std::memory_order_acquire);
+    int bytes = pkt->size + sizeof(MyAVPacketList);
+    int old_size = size.fetch_sub(bytes);
+    int64_t old_duration = duration.fetch_sub(pkt->duration);
+    nb_packets--;
+    //只在从上限以上回落的那一次唤醒读取线程
+    if ((max_bytes > 0 && old_size >= max_bytes && old_size - bytes < max_bytes) ||
+        (max_duration > 0 && old_duration >= max_duration && old_duration - pkt->duration < max_duration))
+    {
+        signal_continue();
+    }
+    if (stale)
+    {
+        dropped++;
+    }
+    return stale;
+}
+
+void PacketQueue::wake_spsc(std::atomic<int> &waiting, int ready)
+{
+    //索引的修改必须在读取waiting之前对另一方可见，否则可能丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ready && waiting.load(std::memory_order_relaxed))
+    {
+        SDL_LockMutex(mutex);
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+        wakeups++;
+    }
+}
+
+void PacketQueue::signal_consumer(int force)
+{
+    //需要持有mutex，只有消费者在等待并且积攒够了才唤醒
+    if (consumer_waiting && (force || nb_packets >= consumer_wake_threshold))
+    {
+        SDL_CondSignal(cond);
+        wakeups++;
+    }
+}
+
+int PacketQueue::get_batch_spsc(MyAVPacketList **nodes, int nb, int block)
+{
+    unsigned r = ring_rindex.load(std::memory_order_relaxed);
+    unsigned w;
+    int n = 0;
+retry:
+    for (;;)
+    {
+        if (abort_request)
+        {
+            return -1;
+        }
+        w = ring_windex.load(std::memory_order_acquire);
+        if (w != r)
+        {
+            break;
+        }
+        if (!block)
+        {
+            return 0;
+        }
+        //队列为空，才加锁等待生产者唤醒
+        SDL_LockMutex(mutex);
+        consumer_waiting.store(1);
+        if (!abort_request && ring_windex.load() == r)
+        {
+            timed_cond_wait(cond, mutex, consumer_waits, consumer_wait_us, consumer_wait_timeout());
+        }
+        consumer_waiting.store(0);
+        SDL_UnlockMutex(mutex);
+    }
+
+    //一次取走当前可读的所有packet(最多nb个)，只发布一次rindex
+    for (; n < nb && r != w; r++)
+    {
+        nodes[n] = pool_acquire();
+        if (!nodes[n])
+        {
+            break;
+        }
+        av_packet_move_ref(nodes[n]->pkt, ring[r & (ring_size - 1)]);
+        nodes[n]->serial = ring_serials[r & (ring_size - 1)];
+        if (account_removed(nodes[n]->pkt))
+        {
+            release(nodes[n]); //过载时丢弃的积压packet
+            continue;
+        }
+        n++;
+    }
+    ring_rindex.store(r, std::memory_order_release);
+    wake_spsc(producer_waiting, ring_size - (w - r) >= (unsigned)producer_wake_space);
+    if (n == 0 && r == w)
+    {
+        //读取到的packet全部被丢弃
+        if (!block)
+        {
+            return 0;
+        }
+        goto retry;
+    }
+    return n > 0 ? n : AVERROR(ENOMEM);
+}
+
+int PacketQueue::put_batch_spsc(AVPacket **pkts, int nb)
+{
+    unsigned w = ring_windex.load(std::memory_order_relaxed);
+    unsigned r;
+    int n = 0;
+    int force = 0;
+    while (n < nb)
+    {
+        if (abort_request)
+        {
+            return -1;
+        }
+        r = ring_rindex.load(std::memory_order_acquire);
+        if (w - r >= ring_size)
+        {
+            //队列已满，加锁等待消费者唤醒
+            SDL_LockMutex(mutex);
+            producer_waiting.store(1);
+            if (!abort_request && w - ring_rindex.load() >= ring_size)
+            {
+                timed_cond_wait(cond, mutex, producer_waits, producer_wait_us, producer_wait_timeout());
+            }
+            producer_waiting.store(0);
+            SDL_UnlockMutex(mutex);
+            continue;
+        }
+
+        //写满当前的空闲位置之后只发布一次windex
+        for (; n < nb && w - r < ring_size; n++, w++)
+        {
+            AVPacket *slot = ring[w & (ring_size - 1)];
+            force |= !pkts[n]->data; //结束的空packet需要立即唤醒
+            av_packet_move_ref(slot, pkts[n]);
+            ring_serials[w & (ring_size - 1)] = serial;
+            account_added(slot);
+        }
+        ring_windex.store(w, std::memory_order_release);
+        //写满时生产者会等待，必须唤醒消费者
+        wake_spsc(consumer_waiting, force || w - r >= ring_size || nb_packets >= consumer_wake_threshold);
+    }
+    return n;
+}
+
 MyAVPacketList *PacketQueue::get(int block)
 {
-    MyAVPacketList *temp = new MyAVPacketList();
-    temp->init();
-    int ret = 0;
+    MyAVPacketList *temp = NULL;
+    if (get_batch(&temp, 1, block) <= 0)
+    {
+        return NULL;
+    }
+    return temp;
+}
+
+int PacketQueue::get_batch(MyAVPacketList **nodes, int nb, int block)
+{
+    int n = 0;
+    if (nb <= 0)
+    {
+        return 0;
+    }
+    if (ring)
+    {
+        return get_batch_spsc(nodes, nb, block);
+    }
 
     SDL_LockMutex(mutex); //加锁
 
@@ -44,107 +492,180 @@ MyAVPacketList *PacketQueue::get(int block)
     {
         if (abort_request)
         {
-            ret = -1;
+            n = -1;
             break;
         }
 
-        //检查buffer的空间
-        if (av_fifo_size(packet_list) >= sizeof(MyAVPacketList))
+        //检查buffer中是否有packet节点，有则一次读取最多nb个
+        if (av_fifo_size(packet_list) >= sizeof(MyAVPacketList *))
         {
-            av_fifo_generic_read(packet_list, temp, sizeof(MyAVPacketList), NULL);
-            nb_packets--;
-            size -= temp->pkt->size + sizeof(MyAVPacketList);
-            duration -= temp->pkt->duration;
-            ret = 1;
-            break;
+            while (n < nb && av_fifo_size(packet_list) >= sizeof(MyAVPacketList *))
+            {
+                av_fifo_generic_read(packet_list, &nodes[n], sizeof(MyAVPacketList *), NULL);
+                if (account_removed(nodes[n]->pkt))
+                {
+                    release(nodes[n]); //过载时丢弃的积压packet
+                    continue;
+                }
+                n++;
+            }
+            //读取到的packet全部被丢弃时继续等待
+            if (n > 0 || !block)
+            {
+                break;
+            }
         }
         else if (!block)
         {
-            ret = 0;
             break;
         }
         else
         {
-            SDL_CondWait(cond, mutex);
+            consumer_waiting = 1;
+            timed_cond_wait(cond, mutex, consumer_waits, consumer_wait_us, consumer_wait_timeout());
+            consumer_waiting = 0;
         }
     }
     SDL_UnlockMutex(mutex); //解锁
-    if (ret <= 0)
-    {
-        delete temp;
-        return NULL;
-    }
-    else
-        return temp;
+    return n;
 }
 
 void PacketQueue::flush()
 {
-    MyAVPacketList temp;
-    temp.init();
+    if (ring)
+    {
+        //由消费者一侧调用，或者在消费者线程退出之后调用
+        unsigned r = ring_rindex.load(std::memory_order_relaxed);
+        unsigned w = ring_windex.load(std::memory_order_acquire);
+        for (; r != w; r++)
+        {
+            av_packet_unref(ring[r & (ring_size - 1)]);
+            get_count++;
+        }
+        nb_packets = 0;
+        size = 0;
+        duration = 0;
+        ring_rindex.store(r, std::memory_order_release);
+        wake_spsc(producer_waiting, 1);
+        signal_continue();
+        return;
+    }
+    MyAVPacketList *temp;
     SDL_LockMutex(mutex);
-    while (av_fifo_size(packet_list) >= sizeof(MyAVPacketList))
+    while (av_fifo_size(packet_list) >= sizeof(MyAVPacketList *))
     {
-        av_fifo_generic_read(packet_list, &temp, sizeof(MyAVPacketList), NULL);
-        av_packet_free(&temp.pkt);
+        av_fifo_generic_read(packet_list, &temp, sizeof(MyAVPacketList *), NULL);
+        release(temp);
     }
     nb_packets = 0;
     size = 0;
     duration = 0;
+    get_count = put_count; //put也持有mutex，两者一致
 
     SDL_UnlockMutex(mutex);
+    signal_continue();
 }
 
 int PacketQueue::put_internal(AVPacket *pkt)
 {
-    MyAVPacketList *temp = new MyAVPacketList();
+    MyAVPacketList *temp;
     int ret = 0;
-    ret = temp->init();
-    if (ret < 0)
-    {
-        goto fail;
-    }
     if (abort_request)
     {
-        ret = -1;
-        goto fail;
+        return -1;
     }
-    
+
     //检查buffer中的空间是否足够，不够就增加空间
-    if (av_fifo_space(packet_list) < sizeof(MyAVPacketList))
+    if (av_fifo_space(packet_list) < sizeof(MyAVPacketList *))
     {
-        ret = av_fifo_grow(packet_list, sizeof(MyAVPacketList));
+        //成倍增长，稳定之后不再重新分配
+        ret = av_fifo_grow(packet_list, FFMAX(av_fifo_size(packet_list), (int)sizeof(MyAVPacketList *)));
         if (ret < 0)
         {
-            goto fail;
+            return ret;
         }
     }
 
+    temp = pool_acquire();
+    if (!temp)
+    {
+        return AVERROR(ENOMEM);
+    }
     av_packet_move_ref(temp->pkt, pkt);
+    temp->serial = serial;
 
-    av_fifo_generic_write(packet_list, temp, sizeof(MyAVPacketList), NULL); //写入到buffer中
+    av_fifo_generic_write(packet_list, &temp, sizeof(MyAVPacketList *), NULL); //写入到buffer中
     //更新队列中的数据
-    nb_packets++;
-    size += temp->pkt->size + sizeof(MyAVPacketList);
-    duration += pkt->duration;
-    SDL_CondSignal(cond); //唤醒条件变量
-    if (ret < 0)
-    {
-    fail:
-        delete temp;
-    }
-    return ret;
+    account_added(temp->pkt);
+    return 0;
 }
 
 int PacketQueue::put(AVPacket *pkt)
 {
     int ret;
+    if (overload_drop(pkt))
+    {
+        return 0;
+    }
+    if (ring)
+    {
+        ret = put_batch_spsc(&pkt, 1);
+        return ret < 0 ? ret : 0;
+    }
+    int force = !pkt->data;
     SDL_LockMutex(mutex);
     ret = put_internal(pkt);
+    if (ret >= 0)
+    {
+        signal_consumer(force); //唤醒条件变量
+    }
     SDL_UnlockMutex(mutex);
     return ret;
 }
 
+int PacketQueue::put_batch(AVPacket **pkts, int nb)
+{
+    int ret = 0;
+    int n = 0;
+    int kept = 0;
+    //过载时丢弃的packet从数组中移除，保留的packet移动到数组前面
+    for (int i = 0; i < nb; i++)
+    {
+        if (!overload_drop(pkts[i]))
+        {
+            AVPacket *tmp = pkts[kept];
+            pkts[kept++] = pkts[i];
+            pkts[i] = tmp;
+        }
+    }
+    nb = kept;
+    if (nb == 0)
+    {
+        return 0;
+    }
+    if (ring)
+    {
+        return put_batch_spsc(pkts, nb);
+    }
+    int force = 0;
+    SDL_LockMutex(mutex);
+    for (; n < nb; n++)
+    {
+        force |= !pkts[n]->data;
+        ret = put_internal(pkts[n]);
+        if (ret < 0)
+        {
+            break;
+        }
+    }
+    if (n > 0)
+    {
+        signal_consumer(force); //整批写入之后只唤醒一次
+    }
+    SDL_UnlockMutex(mutex);
+    return n > 0 ? n : ret;
+}
+
 void PacketQueue::start()
 {
     SDL_LockMutex(mutex);
@@ -156,13 +677,32 @@ void PacketQueue::abort()
 {
     SDL_LockMutex(mutex);
     abort_request = 1;
-    SDL_CondSignal(cond);
+    SDL_CondBroadcast(cond);
     SDL_UnlockMutex(mutex);
+    signal_continue(); //终止的队列不再参与读取线程的等待判断
 }
 
 void PacketQueue::destory()
 {
+    flush();
     av_fifo_freep(&packet_list);
+    if (ring)
+    {
+        for (unsigned i = 0; i < ring_size; i++)
+        {
+            av_packet_free(&ring[i]);
+        }
+        av_freep(&ring);
+        av_freep(&ring_serials);
+        ring_size = 0;
+    }
+    while (free_list)
+    {
+        MyAVPacketList *node = free_list;
+        free_list = node->next;
+        delete node;
+    }
+    logi("PacketQueue pool: %lld hits, %lld misses\n", (long long)pool_hits, (long long)pool_misses);
     SDL_DestroyCond(cond);
     SDL_DestroyMutex(mutex);
 }
@@ -172,6 +712,16 @@ int PacketQueue::isAbort()
     return abort_request;
 }
 
+int PacketQueue::next_serial()
+{
+    return ++serial;
+}
+
+int PacketQueue::get_serial()
+{
+    return serial;
+}
+
 PacketQueue::~PacketQueue()
 {
     std::cout << "destory packet queue" << std::endl;
@@ -1,5 +1,7 @@
 #include "Player.h"
 #include <iostream>
+#include <thread>
+#include <sys/resource.h>
 #include "player_util.h"
 
 extern "C"
@@ -10,10 +12,97 @@ extern "C"
 /*****************************************************/
 /*                      global                       */
 /*****************************************************/
+/**
+ * read_thread中为一个stream积攒的一批packet，攒够之后通过put_batch一次写入队列
+ * */
+struct PacketBatch
+{
+    PacketQueue *queue = NULL;
+    AVPacket *pkts[MAX_PACKET_BATCH] = {NULL};
+    int nb = 0;
+    int max = 1;
+
+    int init(PacketQueue *queue, int max)
+    {
+        this->queue = queue;
+        this->max = FFMIN(FFMAX(max, 1), MAX_PACKET_BATCH);
+        for (int i = 0; i < this->max; i++)
+        {
+            if (!(pkts[i] = av_packet_alloc()))
+            {
+                return AVERROR(ENOMEM);
+            }
+        }
+        return 0;
+    }
+
+    int flush()
+    {
+        int ret = 0;
+        if (nb > 0)
+        {
+            ret = queue->put_batch(pkts, nb);
+            for (int i = 0; i < nb; i++)
+            {
+                av_packet_unref(pkts[i]); //写入失败时释放剩下的packet
+            }
+            nb = 0;
+        }
+        return ret;
+    }
+
+    /**
+     * 丢弃还没有写入队列的packet
+     * */
+    void drop()
+    {
+        for (int i = 0; i < nb; i++)
+        {
+            av_packet_unref(pkts[i]);
+        }
+        nb = 0;
+    }
+
+    /**
+     * 攒够一批，或者解码线程已经没有数据可读时写入队列
+     * */
+    int put(AVPacket *pkt)
+    {
+        if (max <= 1)
+        {
+            return queue->put(pkt);
+        }
+        av_packet_move_ref(pkts[nb++], pkt);
+        if (nb >= max || queue->is_empty())
+        {
+            return flush();
+        }
+        return 0;
+    }
+
+    ~PacketBatch()
+    {
+        for (int i = 0; i < MAX_PACKET_BATCH; i++)
+        {
+            av_packet_free(&pkts[i]);
+        }
+    }
+};
+
+/**
+ * 退出时打断阻塞在网络读取中的av_read_frame等调用
+ * */
+static int decode_interrupt_cb(void *ctx)
+{
+    VideoState *state = (VideoState *)ctx;
+    return state->abort_request;
+}
+
 int read_thread(void *arg)
 {
     VideoState *state = (VideoState *)arg;
     AVPacket *pkt;
+    PacketBatch video_batch, audio_batch;
     int ret = 0;
     int err;
     int video_index = -1, audio_index = -1;
@@ -23,6 +112,12 @@ int read_thread(void *arg)
         ret = AVERROR(ENOMEM);
         goto fail;
     }
+    if (video_batch.init(state->video_queue, state->opts.packet_batch_size) < 0 ||
+        audio_batch.init(state->audio_queue, state->opts.packet_batch_size) < 0)
+    {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
 
     //开始分配format context，打开输入文件等，然后将音频流和视频流等写入到队列中
     state->format_ctx = avformat_alloc_context();
@@ -32,6 +127,8 @@ int read_thread(void *arg)
         ret = AVERROR(ENOMEM);
         goto fail;
     }
+    state->format_ctx->interrupt_callback.callback = decode_interrupt_cb;
+    state->format_ctx->interrupt_callback.opaque = state;
 
     err = avformat_open_input(&state->format_ctx, state->filename, state->iformat, NULL);
     if (err < 0)
@@ -50,6 +147,7 @@ int read_thread(void *arg)
     }
 
     av_dump_format(state->format_ctx, 0, state->filename, 0);
+    state->max_frame_duration = (state->format_ctx->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
 
     // 找到合适的视频流和音频流的index
     for (int i = 0; i < state->format_ctx->nb_streams; i++)
@@ -76,7 +174,7 @@ int read_thread(void *arg)
         state->stream_componet_open(video_index);
     }
 
-    if (audio_index >= 0)
+    if (audio_index >= 0 && !state->opts.audio_disable)
     {
         state->stream_componet_open(audio_index);
     }
@@ -87,6 +185,12 @@ int read_thread(void *arg)
         ret = -1;
         goto fail;
     }
+    if (!state->video_stream)
+    {
+        //没有视频时不支持倍速
+        state->playback_rate = 1.0;
+    }
+    state->apply_playback_mode();
 
     //无限循环读取
     for (;;)
@@ -95,11 +199,42 @@ int read_thread(void *arg)
         {
             break;
         }
+        if (state->seek_req)
+        {
+            //还没写入队列的packet属于seek之前的位置
+            video_batch.drop();
+            audio_batch.drop();
+            state->do_seek();
+        }
+        //队列中缓存的数据足够多时，等待解码线程取走数据，不再继续读取
+        if (state->queues_have_enough())
+        {
+            video_batch.flush();
+            audio_batch.flush();
+        }
+        SDL_LockMutex(state->continue_read_mutex);
+        while (!state->abort_request && !state->seek_req && state->queues_have_enough())
+        {
+            timed_cond_wait(state->continue_read_cond, state->continue_read_mutex, state->read_waits, state->read_wait_us);
+        }
+        SDL_UnlockMutex(state->continue_read_mutex);
+        if (state->abort_request)
+        {
+            break;
+        }
+        if (state->seek_req)
+        {
+            continue;
+        }
+        int64_t read_start = av_gettime_relative();
         ret = av_read_frame(state->format_ctx, pkt);
+        state->demux_latency.add(av_gettime_relative() - read_start);
         if (ret < 0)
         {
-            if ((ret == AVERROR_EOF || avio_feof(state->format_ctx->pb) && !state->eof))
+            if ((ret == AVERROR_EOF || avio_feof(state->format_ctx->pb)) && !state->eof)
             {
+                video_batch.flush();
+                audio_batch.flush();
                 if (state->video_stream_index >= 0)
                 {
                     pkt->stream_index = state->video_stream_index;
@@ -116,6 +251,16 @@ int read_thread(void *arg)
             {
                 break;
             }
+            if (state->eof)
+            {
+                //文件已经读完，等待seek或者退出，不再空转
+                SDL_LockMutex(state->continue_read_mutex);
+                if (!state->abort_request && !state->seek_req)
+                {
+                    SDL_CondWaitTimeout(state->continue_read_cond, state->continue_read_mutex, READ_EOF_WAIT_MS);
+                }
+                SDL_UnlockMutex(state->continue_read_mutex);
+            }
             continue;
         }
         else
@@ -125,11 +270,22 @@ int read_thread(void *arg)
         //在此处可以做一些其他的判断，控制packet进入到队列中。比如限制播放时长等
         if (pkt->stream_index == state->video_stream_index)
         {
-            state->video_queue->put(pkt);
+            if (pkt->flags & AV_PKT_FLAG_KEY)
+            {
+                state->keyframe_index.add(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts, pkt->pos);
+            }
+            else if (state->keyframes_only)
+            {
+                //高倍速时非关键帧不进入队列，吞吐量不受完整解码速度的限制
+                state->nonkey_dropped++;
+                av_packet_unref(pkt);
+                continue;
+            }
+            video_batch.put(pkt);
         }
-        else if (pkt->stream_index == state->audio_stream_index)
+        else if (pkt->stream_index == state->audio_stream_index && !state->audio_muted)
         {
-            state->audio_queue->put(pkt);
+            audio_batch.put(pkt);
         }
         else
         {
@@ -153,18 +309,20 @@ fail:
 int video_thread(void *arg)
 {
     VideoState *state = (VideoState *)arg;
-    AVFrame *frame = av_frame_alloc();
     int ret = 0;
     int frame_ctn = 0;
     AVRational frame_rate = av_guess_frame_rate(state->format_ctx, state->video_stream, NULL);
-    if (!frame)
-    {
-        logf("Failed to alloc frame.\n");
-        return AVERROR(ENOMEM);
-    }
     for (;;)
     {
-        int got_frame = state->video_decoder->decode_frame(frame);
+        //先取得frame queue中可写入的位置，直接解码到该位置的frame中
+        Frame *vp = state->video_frame_queue->peekWritable();
+        if (!vp)
+        {
+            ret = -1;
+            goto end;
+        }
+        int64_t decode_start = av_gettime_relative();
+        int got_frame = state->video_decoder->decode_frame(vp->frame);
         if (got_frame < 0)
         {
             goto end;
@@ -173,46 +331,198 @@ int video_thread(void *arg)
         {
             continue;
         }
-        if (got_frame)
+        double duration = (frame_rate.num && frame_rate.den) ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0;
+        double pts = av_frame_get_best_effort_timestamp(vp->frame);
+        pts = pts != AV_NOPTS_VALUE ? pts : 0;
+        pts *= av_q2d(state->video_stream->time_base);
+        int64_t decode_time = av_gettime_relative() - decode_start;
+        //等待packet的时间不是解码的抖动，增加frame queue的深度也没有帮助
+        int64_t codec_time = decode_time - state->video_decoder->get_wait_us();
+        if (state->video_frame_queue->adapt_depth(codec_time / 1000000.0, duration) < 0 && state->video_frame_pool)
+        {
+            //队列变浅之后不再需要那么多buffer
+            state->video_frame_pool->trim();
+        }
+        state->decode_latency.add(decode_time);
+        state->frames_decoded++;
+
+        //精确seek：关键帧到目标之间的frame只解码不显示，从离目标最近的一帧开始显示
+        if (state->before_seek_target(&state->video_seek, state->video_decoder->get_pkt_serial(), pts + duration / 2))
         {
-            int duration = (frame_rate.num && frame_rate.den) ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0;
-            double pts = av_frame_get_best_effort_timestamp(frame);
-            pts = pts != AV_NOPTS_VALUE ? pts : 0;
-            pts *= av_q2d(state->video_stream->time_base);
+            av_frame_unref(vp->frame);
+            continue;
+        }
 
-            Frame *ret_frame = state->video_frame_queue->put(frame, duration, pts, frame->pkt_pos);
-            //在这里设置player的宽和高
+        //按落后于主时钟的程度和显示队列是否已空调整解码的降级级别
+        state->video_decoder->update_skip_policy(state->get_master_clock() - pts, duration,
+                                                 state->video_frame_queue->is_empty());
 
-            frame_ctn++;
-            logf("frame count=%d\n", frame_ctn);
-            if (ret_frame)
-            {
-                ret = 0;
-                state->player->set_default_window_size(ret_frame->width, ret_frame->height, ret_frame->sar);
-            }
-            else
+        //已经落后于主时钟的frame不再写入队列，省去后面的显示
+        if (state->opts.framedrop && state->get_master_sync_type() != AV_SYNC_VIDEO_MASTER &&
+            state->video_decoder->get_pkt_serial() == state->video_queue->get_serial() && !state->video_queue->is_empty())
+        {
+            double diff = pts - state->get_master_clock();
+            if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD && diff < 0)
             {
-                ret = -1;
+                state->frame_drops_early++;
+                av_frame_unref(vp->frame);
+                continue;
             }
-            av_frame_unref(frame);
         }
-        if (ret < 0)
+
+        vp->set_props(duration, pts, vp->frame->pkt_pos, state->video_decoder->get_pkt_serial());
+        //在这里设置player的宽和高，发布之后vp就属于显示线程了
+        state->player->set_default_window_size(vp->width, vp->height, vp->sar);
+        state->video_frame_queue->commit();
+
+        frame_ctn++;
+        logd("frame count=%d\n", frame_ctn);
+    }
+end:
+    return ret;
+}
+
+int audio_thread(void *arg)
+{
+    VideoState *state = (VideoState *)arg;
+    int ret = 0;
+    int last_serial = -1;
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+    {
+        return AVERROR(ENOMEM);
+    }
+    for (;;)
+    {
+        int got_frame = state->audio_decoder->decode_frame(frame);
+        if (got_frame < 0)
         {
             goto end;
         }
+        if (!got_frame)
+        {
+            continue;
+        }
+        int serial = state->audio_decoder->get_pkt_serial();
+        if (serial != state->audio_queue->get_serial() || state->audio_muted)
+        {
+            av_frame_unref(frame); //seek之前的frame直接丢弃
+            continue;
+        }
+        //精确seek：丢弃完全在目标之前的frame
+        if (frame->pts != AV_NOPTS_VALUE &&
+            state->before_seek_target(&state->audio_seek, serial, (frame->pts + frame->nb_samples) / (double)frame->sample_rate))
+        {
+            av_frame_unref(frame);
+            continue;
+        }
+        if (serial != last_serial)
+        {
+            //seek之后缓冲区中还没播放的数据也已经过期
+            state->audio_ring->flush();
+            last_serial = serial;
+        }
+
+        //frame->pts已经由Decoder转换为1/sample_rate的单位
+        if (frame->pts != AV_NOPTS_VALUE)
+        {
+            state->audio_ring->set_clock_anchor(frame->pts / (double)frame->sample_rate, serial);
+        }
+        int len = state->audio_resample(frame, state->synchronize_audio(frame->nb_samples));
+        av_frame_unref(frame);
+        if (len < 0)
+        {
+            continue;
+        }
+        //写满之后等待回调消费，期间检查退出位
+        const uint8_t *data = state->audio_buf;
+        while (len > 0 && !state->audio_queue->isAbort() && serial == state->audio_queue->get_serial())
+        {
+            int n = state->audio_ring->write(data, len);
+            data += n;
+            len -= n;
+            if (len > 0)
+            {
+                state->audio_ring->wait_space(len, AUDIO_RING_WAIT_MS);
+            }
+        }
     }
 end:
     av_frame_free(&frame);
     return ret;
 }
 
-Uint32 sdl_refresh_timer_cb(Uint32 interval, void *opaque)
+/**
+ * SDL音频线程中调用，只从无锁缓冲区中读取，不加锁也不等待，数据不足时输出静音
+ * */
+void sdl_audio_callback(void *opaque, Uint8 *stream, int len)
+{
+    VideoState *state = (VideoState *)opaque;
+    double callback_time = av_gettime_relative() / 1000000.0;
+    double pts;
+    int serial;
+    int n = state->audio_ring->read(stream, len);
+    if (state->audio_muted)
+    {
+        n = 0; //倍速播放时缓冲区中剩下的数据也不再输出
+    }
+    if (n < len)
+    {
+        memset(stream + n, 0, len - n);
+    }
+    //刚读取的数据之前还有一个回调长度的数据在设备中等待播放
+    if (state->audio_ring->read_clock(&pts, &serial))
+    {
+        state->audclk.set_at(pts - (double)(2 * state->audio_hw_buf_size) / state->audio_tgt.bytes_per_sec, serial, callback_time);
+    }
+}
+
+/**
+ * 在SDL的定时器线程中调用，SDL_RemoveTimer不会等待正在执行的回调，
+ * 所以这里不访问VideoState，只通知主线程输出
+ * */
+Uint32 sdl_stats_timer_cb(Uint32 interval, void *opaque)
 {
     SDL_Event event;
-    event.type = FF_REFRESH_TIMER;
+    event.type = FF_STATS_EVENT;
     event.user.data1 = opaque;
     SDL_PushEvent(&event);
-    return 0; /* 0 means stop timer */
+    return interval; /* 继续定时输出 */
+}
+
+void log_queue_stats(const char *name, const QueueStats *stats)
+{
+    logi("%-17s items=%d (max %d, depth %d) bytes=%lld (max %lld) duration=%.3fs (max %.3fs) "
+         "producer_wait=%lld/%.1fms consumer_wait=%lld/%.1fms wakeups=%lld dropped=%lld (%lld gops) pool=%lld hits/%lld misses\n",
+         name, stats->nb_items, stats->max_nb_items, stats->depth,
+         (long long)stats->size, (long long)stats->max_size,
+         stats->duration, stats->max_duration,
+         (long long)stats->producer_waits, stats->producer_wait_us / 1000.0,
+         (long long)stats->consumer_waits, stats->consumer_wait_us / 1000.0,
+         (long long)stats->wakeups,
+         (long long)stats->dropped, (long long)stats->dropped_gops,
+         (long long)stats->pool_hits, (long long)stats->pool_misses);
+}
+
+void log_latency_stats(const char *name, const LatencyStats *stats)
+{
+    int64_t count = stats->count;
+    logi("%-17s %lld samples, avg %.3fms, max %.3fms\n", name, (long long)count,
+         count ? stats->total_us / 1000.0 / count : 0, stats->max_us / 1000.0);
+}
+
+int64_t peak_memory_bytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss; //macOS上单位为字节
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
 }
 
 Player::Player(/* args */)
@@ -252,86 +562,369 @@ void Player::calculate_display_rect(SDL_Rect *rect, int scr_xleft, int scr_ytop,
     rect->h = FFMAX((int)height, 1);
 }
 
-void Player::video_refresh_timer(void *arg)
+double Player::frame_delay(Frame *vp)
+{
+    //serial变化后(seek)立即显示
+    if (vp->serial != state->frame_last_serial)
+    {
+        return 0;
+    }
+    double delay = vp->pts - state->frame_last_pts;
+    if (isnan(delay) || delay <= 0 || delay >= state->max_frame_duration)
+    {
+        return state->frame_last_delay;
+    }
+    //倍速播放时按时钟的速度缩短显示的时间
+    return delay / state->vidclk.get_speed();
+}
+
+/**
+ * vp的显示时长，优先使用相邻两帧的pts差值
+ * */
+double Player::frame_duration(Frame *vp, Frame *nextvp)
+{
+    if (vp->serial != nextvp->serial)
+    {
+        return 0.0;
+    }
+    double duration = nextvp->pts - vp->pts;
+    if (isnan(duration) || duration <= 0 || duration >= state->max_frame_duration)
+    {
+        duration = vp->duration;
+    }
+    return duration / state->vidclk.get_speed();
+}
+
+/**
+ * 睡眠到deadline(av_gettime_relative，微秒)。先用系统的睡眠到接近deadline，
+ * 最后RENDER_SPIN_US让出cpu轮询，避免系统定时器的精度带来的抖动
+ * */
+static void precise_sleep_until(int64_t deadline)
+{
+    int64_t remaining = deadline - av_gettime_relative();
+    if (remaining > RENDER_SPIN_US)
+    {
+        av_usleep((unsigned)(remaining - RENDER_SPIN_US));
+    }
+    while (av_gettime_relative() < deadline)
+    {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * 在主线程中执行，只用非阻塞的方式读取frame，等待由render_loop负责
+ * */
+double Player::video_refresh()
 {
-    double actual_delay, delay;
+    double delay, time, remaining_time = REFRESH_RATE;
+    //开启垂直同步时SDL_RenderPresent会等到下一次刷新，提前半个刷新周期提交，使呈现落在离目标时间最近的一次刷新上
+    double present_lead = vsync_period / 2;
     Frame *vp;
+    double rate = state->playback_rate;
+
+    //视频和外部时钟只在渲染循环中写入，速度也在这里修改
+    if (rate != state->vidclk.get_speed())
+    {
+        state->vidclk.set_speed(rate);
+        state->extclk.set_speed(rate);
+    }
+
+    if (!state->video_stream)
+    {
+        state->extclk.sync_to_slave(&state->audclk);
+        return RENDER_MAX_SLEEP;
+    }
 
-    if (state->video_stream)
+retry:
+    //丢弃seek之前解码出来的过期frame
+    while ((vp = state->video_frame_queue->peek_until(0)) && vp->serial != state->video_queue->get_serial())
     {
-        if (state->video_frame_queue->is_empty())
+        state->video_frame_queue->next();
+    }
+
+    if (vp && options.bench_fast)
+    {
+        //不按时间显示，测量整个流水线的吞吐量
+        state->vidclk.set(vp->pts, vp->serial);
+        state->frame_last_serial = vp->serial;
+        present(vp);
+        return 0;
+    }
+
+    if (vp)
+    {
+        delay = state->compute_target_delay(frame_delay(vp));
+        time = av_gettime_relative() / 1000000.0;
+        if (vp->serial != state->frame_last_serial)
+        {
+            state->frame_timer = time;
+            state->frame_last_serial = vp->serial;
+            //seek之后外部时钟从新的位置开始
+            state->extclk.set(vp->pts, vp->serial);
+        }
+
+        if (time < state->frame_timer + delay - present_lead)
         {
-            loge("video refresh do nothing...\n");
-            //do nothing.
-            // schedule_refresh(1); //frame queue 中没有frame，那么就延时1ms显示
+            //还没到显示时间，frame留在队列中，到期时再刷新
+            remaining_time = state->frame_timer + delay - present_lead - time;
         }
         else
         {
-            vp = state->video_frame_queue->get();
-
-            state->video_current_pts = vp->pts;
-            state->video_current_pts_time = av_gettime();
-            delay = vp->pts - state->frame_last_pts;
+            if (delay > 0)
+            {
+                state->frame_last_delay = delay;
+            }
+            state->frame_last_pts = vp->pts;
+            state->frame_timer += delay;
+            state->vidclk.set(vp->pts, vp->serial);
+            state->extclk.sync_to_slave(&state->vidclk);
 
-            if (delay <= 0 || delay >= 1.0)
+            //后面还有frame，并且这一帧的显示时间已经过去了，直接丢弃追赶进度
+            if (state->opts.framedrop && state->video_frame_queue->nb_remaining() > 1)
             {
-                delay = state->frame_last_delay;
+                Frame *nextvp = state->video_frame_queue->peekNext();
+                if (time > state->frame_timer + frame_duration(vp, nextvp))
+                {
+                    state->frame_drops_late++;
+                    state->video_frame_queue->next();
+                    goto retry;
+                }
             }
 
-            state->frame_last_delay = delay;
-            state->frame_last_pts = vp->pts;
+            //队列中已经没有可丢弃的frame仍然落后太多，重新对齐不再追赶
+            if (time - state->frame_timer > AV_SYNC_THRESHOLD_MAX)
+            {
+                state->frame_timer = time;
+            }
+            logd("vp pts =%f, delay=%f\n", vp->pts, delay);
 
-            //TODO 音视频同步相关
+            present(vp);
 
-            state->frame_timer += delay;
-            actual_delay = state->frame_timer - (av_gettime() / 1000000.0);
-            if (actual_delay < 0.010)
+            //下一帧已经解码好则精确定时到它的显示时间，否则继续轮询
+            if ((vp = state->video_frame_queue->peek_until(0)))
             {
-                actual_delay = 0.010;
+                remaining_time = state->frame_timer + state->compute_target_delay(frame_delay(vp)) - present_lead -
+                                 av_gettime_relative() / 1000000.0;
             }
-            logi("vp pts =%f, delay=%f, actual_delay=%f\n", vp->pts, delay, actual_delay);
-            schedule_refresh((int)(actual_delay * 1000 + 0.5));
+        }
+    }
+    return FFMAX(remaining_time, 0.0);
+}
+
+void Player::present(Frame *vp)
+{
+    int64_t start = av_gettime_relative();
+    state->queue_latency.add(start - vp->commit_time);
+    if (state->seek_request_time && vp->serial == state->video_seek.serial)
+    {
+        state->seek_latency.add(start - state->seek_request_time);
+        state->seek_request_time = 0;
+    }
+    //show picture
+    video_display(vp);
+    state->video_frame_queue->next(); //显示完成后释放frame，归还位置给解码线程
+    state->render_latency.add(av_gettime_relative() - start);
+    state->frames_displayed++;
+}
 
-            //show picture
-            video_display(vp);
+/**
+ * 在主线程中创建renderer，开启垂直同步时记录刷新周期
+ * */
+int Player::create_renderer()
+{
+    SDL_RendererInfo info = {0};
+    SDL_DisplayMode mode;
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+    if (options.vsync)
+    {
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    //macOS上SDL的窗口和渲染只能在主线程中调用
+    renderer = SDL_CreateRenderer(window, -1, flags);
+    if (!renderer)
+    {
+        logw("Failed to initialize a hardware accelerated renderer: %s\n", SDL_GetError());
+        renderer = SDL_CreateRenderer(window, -1, 0);
+    }
+    if (!renderer)
+    {
+        loge("Failed to create renderer: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_GetRendererInfo(renderer, &info);
+    if ((info.flags & SDL_RENDERER_PRESENTVSYNC) &&
+        SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0)
+    {
+        vsync_period = 1.0 / mode.refresh_rate;
+    }
+    logi("render loop: %s renderer, vsync %s (%.2fms)\n", info.name, vsync_period > 0 ? "on" : "off", vsync_period * 1000);
+    return 0;
+}
+
+void Player::handle_event(SDL_Event *event)
+{
+    switch (event->type)
+    {
+    case FF_QUIT_EVENT:
+    case SDL_QUIT:
+        quit = 1;
+        break;
+    case FF_STATS_EVENT:
+        //close()在渲染循环退出后才执行，这里的state一定还没有释放
+        state->dump_stats();
+        break;
+    case SDL_KEYDOWN:
+        switch (event->key.keysym.sym)
+        {
+        case SDLK_LEFT:
+            state->stream_seek_relative(-SEEK_SHORT_STEP);
+            break;
+        case SDLK_RIGHT:
+            state->stream_seek_relative(SEEK_SHORT_STEP);
+            break;
+        case SDLK_UP:
+            state->stream_seek_relative(SEEK_LONG_STEP);
+            break;
+        case SDLK_DOWN:
+            state->stream_seek_relative(-SEEK_LONG_STEP);
+            break;
+        case SDLK_RIGHTBRACKET:
+            state->set_playback_rate(state->playback_rate * 2);
+            break;
+        case SDLK_LEFTBRACKET:
+            state->set_playback_rate(state->playback_rate / 2);
+            break;
+        case SDLK_BACKSPACE:
+            state->set_playback_rate(1.0);
+            break;
+        default:
+            break;
         }
+        break;
+    default:
+        break;
     }
-    else
+}
+
+void Player::pump_events()
+{
+    SDL_Event event;
+    SDL_PumpEvents();
+    while (!quit && SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
     {
-        schedule_refresh(100);
+        handle_event(&event);
     }
 }
 
-void Player::schedule_refresh(int delay)
+void Player::wait_until(int64_t deadline)
 {
-    SDL_AddTimer(delay, sdl_refresh_timer_cb, state);
+    for (;;)
+    {
+        pump_events();
+        int64_t now = av_gettime_relative();
+        if (quit || now >= deadline)
+        {
+            return;
+        }
+        int64_t slice_end = FFMIN(deadline, now + RENDER_EVENT_SLICE_US);
+        if (state->video_stream && state->video_frame_queue->nb_remaining() == 0)
+        {
+            //没有frame时在frame queue上等待，解码线程写入后立即被唤醒
+            if (state->video_frame_queue->peek_until(slice_end))
+            {
+                return;
+            }
+        }
+        else if (slice_end < deadline)
+        {
+            //还没到最后一段，不需要精确
+            av_usleep((unsigned)(slice_end - now));
+        }
+        else
+        {
+            precise_sleep_until(deadline);
+            return;
+        }
+    }
+}
+
+void Player::render_loop()
+{
+    if (options.headless)
+    {
+        logi("render loop: headless, %s\n", options.bench_fast ? "as fast as possible" : "real-time");
+    }
+    else if (create_renderer() < 0)
+    {
+        quit = 1;
+    }
+
+    while (!quit)
+    {
+        //headless时播放结束后自动退出
+        if (options.headless && state->playback_finished())
+        {
+            quit = 1;
+            break;
+        }
+        double remaining_time = FFMIN(video_refresh(), RENDER_MAX_SLEEP);
+        if (remaining_time <= 0)
+        {
+            pump_events();
+            continue;
+        }
+        wait_until(av_gettime_relative() + (int64_t)(remaining_time * 1000000));
+    }
+
+    if (scaler)
+    {
+        delete scaler;
+        scaler = NULL;
+    }
+    //texture属于renderer，需要先释放
+    if (texture)
+    {
+        SDL_DestroyTexture(texture);
+        texture = NULL;
+    }
+    if (renderer)
+    {
+        SDL_DestroyRenderer(renderer);
+        renderer = NULL;
+    }
 }
 
 void Player::video_display(Frame *vp)
 {
+    //headless时显示到空的输出
+    if (options.headless)
+    {
+        return;
+    }
     if (!width)
     {
         video_open();
     }
 
-    Uint32 pixformat = SDL_PIXELFORMAT_IYUV;
-
-    //create texture for render
-    texture = SDL_CreateTexture(renderer,
-                                pixformat,
-                                SDL_TEXTUREACCESS_STREAMING,
-                                width,
-                                height);
-
     SDL_Rect rect;
-    SDL_UpdateYUVTexture(texture, NULL,
-                         vp->frame->data[0], vp->frame->linesize[0],
-                         vp->frame->data[1], vp->frame->linesize[1],
-                         vp->frame->data[2], vp->frame->linesize[2]);
+    //texture在整个播放过程中复用，只有像素格式或者分辨率变化时才重新创建
+    if (!vp->uploaded)
+    {
+        if (upload_texture(&texture, vp->frame) < 0)
+        {
+            return;
+        }
+        vp->uploaded = 1;
+        vp->flip_v = vp->frame->linesize[0] < 0;
+    }
 
     calculate_display_rect(&rect, left, top, width, height, vp->width, vp->height, vp->sar);
+    set_sdl_yuv_conversion_mode(vp->frame);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, NULL, &rect);
+    SDL_RenderCopyEx(renderer, texture, NULL, &rect, 0, NULL, vp->flip_v ? SDL_FLIP_VERTICAL : SDL_FLIP_NONE);
+    set_sdl_yuv_conversion_mode(NULL);
     SDL_RenderPresent(renderer);
 }
 
@@ -361,7 +954,7 @@ int Player::realloc_texture(SDL_Texture **texture, Uint32 new_format, int new_wi
     return 0;
 }
 
-int Player::upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx)
+int Player::upload_texture(SDL_Texture **tex, AVFrame *frame)
 {
     int ret = 0;
     Uint32 sdl_pix_fmt;
@@ -369,28 +962,38 @@ int Player::upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext
     get_sdl_pix_fmt_and_blendmode(frame->format, &sdl_pix_fmt, &sdl_blendmode);
     if (realloc_texture(tex, sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_ARGB8888 : sdl_pix_fmt, frame->width, frame->height, sdl_blendmode, 0) < 0)
         return -1;
+    //SDL不支持的位深和色度采样，降低之后直接写入texture
+    if (frame->format == AV_PIX_FMT_P010 || frame->format == AV_PIX_FMT_YUV420P10 || frame->format == AV_PIX_FMT_YUV444P)
+    {
+        return upload_texture_reduced(*tex, frame);
+    }
     switch (sdl_pix_fmt)
     {
     case SDL_PIXELFORMAT_UNKNOWN:
         /* This should only happen if we are not using avfilter... */
-        *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-                                                frame->width, frame->height, (AVPixelFormat)(frame->format), frame->width, frame->height,
-                                                AV_PIX_FMT_BGRA, SWS_BICUBIC, NULL, NULL, NULL);
-        if (*img_convert_ctx != NULL)
+        if (!scaler)
+        {
+            //分成多个slice在线程池中并行转换
+            scaler = new SliceScaler();
+            if (scaler->init(options.scale_threads, options.scale_flags) < 0)
+            {
+                delete scaler;
+                scaler = NULL;
+                return -1;
+            }
+        }
         {
-            uint8_t *pixels[4];
-            int pitch[4];
+            uint8_t *pixels[4] = {NULL};
+            int pitch[4] = {0};
             if (!SDL_LockTexture(*tex, NULL, (void **)pixels, pitch))
             {
-                sws_scale(*img_convert_ctx, (const uint8_t *const *)frame->data, frame->linesize,
-                          0, frame->height, pixels, pitch);
+                ret = scaler->scale(frame, AV_PIX_FMT_BGRA, pixels, pitch);
                 SDL_UnlockTexture(*tex);
             }
         }
-        else
+        if (ret < 0)
         {
             av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-            ret = -1;
         }
         break;
     case SDL_PIXELFORMAT_IYUV:
@@ -412,6 +1015,24 @@ int Player::upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext
             return -1;
         }
         break;
+    case SDL_PIXELFORMAT_NV12:
+    case SDL_PIXELFORMAT_NV21:
+        if (frame->linesize[0] > 0 && frame->linesize[1] > 0)
+        {
+            ret = update_nv_texture(*tex, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1], frame->height);
+        }
+        else if (frame->linesize[0] < 0 && frame->linesize[1] < 0)
+        {
+            ret = update_nv_texture(*tex, frame->data[0] + frame->linesize[0] * (frame->height - 1), -frame->linesize[0],
+                                    frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[1],
+                                    frame->height);
+        }
+        else
+        {
+            av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
+            return -1;
+        }
+        break;
     default:
         if (frame->linesize[0] < 0)
         {
@@ -428,16 +1049,21 @@ int Player::upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext
 
 void Player::video_open()
 {
-    int w, h;
-    w = screen_width ? screen_width : default_width;
-    h = screen_height ? screen_height : default_height;
+    width = screen_width ? screen_width : default_width;
+    height = screen_height ? screen_height : default_height;
 
+    window_open();
+}
+
+void Player::window_open()
+{
+    if (!window)
+    {
+        return;
+    }
     SDL_SetWindowTitle(window, state->filename);
-    SDL_SetWindowSize(window, w, h);
+    SDL_SetWindowSize(window, width, height);
     SDL_ShowWindow(window);
-
-    width = w;
-    height = h;
 }
 
 /*****************************************************/
@@ -446,58 +1072,55 @@ void Player::video_open()
 int Player::open(const char *filename, const AVInputFormat *iformat)
 {
     int ret = 0;
-    SDL_Event event;
-    state = new VideoState();
 
-    ret = state->init(filename, iformat);
-    if (ret < 0)
+    Uint32 sdl_flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
+    if (options.headless)
     {
-        delete state;
+        //headless时没有窗口和音频设备，可以在CI等没有显示和声卡的环境中运行
+        sdl_flags = SDL_INIT_TIMER | SDL_INIT_EVENTS;
+        options.audio_disable = 1;
+        if (options.bench_fast)
+        {
+            //尽快解码显示时不丢帧也不降低解码质量，测量的是完整的解码能力
+            options.framedrop = 0;
+            options.decode_skip_max_level = 0;
+        }
+    }
+    //读取线程中会打开音频设备，SDL需要先初始化
+    if (SDL_Init(sdl_flags))
+    {
+        fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
         exit(1);
     }
-    state->player = this;
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
+    state = new VideoState();
+    state->player = this;
+    state->start_time = av_gettime_relative();
+    ret = state->init(filename, iformat, &options);
+    if (ret < 0)
     {
-        fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
+        delete state;
         exit(1);
     }
 
-    window = SDL_CreateWindow("Media Player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, default_width, default_height, SDL_WINDOW_RESIZABLE);
-    if (!window)
+    if (!options.headless)
+    {
+        window = SDL_CreateWindow("Media Player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, default_width, default_height, SDL_WINDOW_RESIZABLE);
+    }
+    if (!options.headless && !window)
     {
         loge("Could not initiablize SDL window - %s\n", SDL_GetError());
         exit(1);
     }
 
-    renderer = SDL_CreateRenderer(window, 0, -1);
-
-    schedule_refresh(40);
-
-    for (;;)
+    if (options.stats_interval > 0)
     {
-        SDL_WaitEvent(&event);
-        switch (event.type)
-        {
-        case FF_QUIT_EVENT:
-        case SDL_QUIT:
-            if (!quit)
-            {
-                quit = 1;
-                close();
-            }
-            break;
-        case FF_REFRESH_TIMER:
-            video_refresh_timer(event.user.data1);
-            break;
-        default:
-            break;
-        }
-        if (quit)
-        {
-            break;
-        }
+        stats_timer = SDL_AddTimer((Uint32)(options.stats_interval * 1000), sdl_stats_timer_cb, state);
     }
+
+    //窗口和渲染都在主线程中，事件也在渲染循环中处理
+    render_loop();
+    close();
     return 0;
 }
 
@@ -519,16 +1142,18 @@ void Player::close()
 {
     if (quit)
     {
-        delete state;
-        state = NULL;
-        if (renderer)
+        if (stats_timer)
         {
-            SDL_DestroyRenderer(renderer);
+            SDL_RemoveTimer(stats_timer);
+            stats_timer = 0;
         }
-        if (texture)
+        state->dump_stats();
+        if (options.headless)
         {
-            SDL_DestroyTexture(texture);
+            state->print_benchmark();
         }
+        delete state;
+        state = NULL;
         if (window)
         {
             SDL_DestroyWindow(window);
@@ -537,6 +1162,183 @@ void Player::close()
     }
 }
 
+/**
+ * 解析 [options] input_file 形式的命令行，返回输入文件在args中的位置
+ * */
+static int parse_options(PlayerOptions *opts, int argv, char **args)
+{
+    int i = 1;
+    for (; i < argv - 1 && args[i][0] == '-'; i++)
+    {
+        if (!strcmp(args[i], "-spsc") && i + 2 < argv)
+        {
+            opts->spsc_queue_capacity = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-stats") && i + 2 < argv)
+        {
+            opts->stats_interval = atof(args[++i]);
+        }
+        else if (!strcmp(args[i], "-latency_budget") && i + 2 < argv)
+        {
+            opts->latency_budget = atof(args[++i]);
+        }
+        else if (!strcmp(args[i], "-wake_batch") && i + 2 < argv)
+        {
+            opts->packet_wake_batch = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-wake_space") && i + 2 < argv)
+        {
+            opts->frame_wake_space = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-wake_delay") && i + 2 < argv)
+        {
+            opts->wake_max_delay_ms = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-frame_queue") && i + 2 < argv)
+        {
+            opts->frame_queue_size = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-frame_queue_max") && i + 2 < argv)
+        {
+            opts->frame_queue_max_size = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-headless"))
+        {
+            opts->headless = 1;
+        }
+        else if (!strcmp(args[i], "-bench_fast"))
+        {
+            opts->headless = 1;
+            opts->bench_fast = 1;
+        }
+        else if (!strcmp(args[i], "-rate") && i + 2 < argv)
+        {
+            opts->playback_rate = atof(args[++i]);
+        }
+        else if (!strcmp(args[i], "-keyframe_rate") && i + 2 < argv)
+        {
+            opts->keyframe_only_rate = atof(args[++i]);
+        }
+        else if (!strcmp(args[i], "-scale_threads") && i + 2 < argv)
+        {
+            opts->scale_threads = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-scale_algo") && i + 2 < argv)
+        {
+            i++;
+            if (!strcmp(args[i], "fast_bilinear"))
+            {
+                opts->scale_flags = SWS_FAST_BILINEAR;
+            }
+            else if (!strcmp(args[i], "bilinear"))
+            {
+                opts->scale_flags = SWS_BILINEAR;
+            }
+            else if (!strcmp(args[i], "point"))
+            {
+                opts->scale_flags = SWS_POINT;
+            }
+            else if (!strcmp(args[i], "area"))
+            {
+                opts->scale_flags = SWS_AREA;
+            }
+            else if (!strcmp(args[i], "lanczos"))
+            {
+                opts->scale_flags = SWS_LANCZOS;
+            }
+            else
+            {
+                opts->scale_flags = SWS_BICUBIC;
+            }
+        }
+        else if (!strcmp(args[i], "-an"))
+        {
+            opts->audio_disable = 1;
+        }
+        else if (!strcmp(args[i], "-no_vsync"))
+        {
+            opts->vsync = 0;
+        }
+        else if (!strcmp(args[i], "-skip_max_level") && i + 2 < argv)
+        {
+            opts->decode_skip_max_level = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-sync") && i + 2 < argv)
+        {
+            i++;
+            if (!strcmp(args[i], "video"))
+            {
+                opts->av_sync_type = AV_SYNC_VIDEO_MASTER;
+            }
+            else if (!strcmp(args[i], "ext"))
+            {
+                opts->av_sync_type = AV_SYNC_EXTERNAL_CLOCK;
+            }
+            else
+            {
+                opts->av_sync_type = AV_SYNC_AUDIO_MASTER;
+            }
+        }
+        else if (!strcmp(args[i], "-audio_buffer") && i + 2 < argv)
+        {
+            opts->audio_buffer_samples = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-audio_ring_ms") && i + 2 < argv)
+        {
+            opts->audio_ring_ms = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-threads") && i + 2 < argv)
+        {
+            opts->decode_threads = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-thread_type") && i + 2 < argv)
+        {
+            i++;
+            if (!strcmp(args[i], "frame"))
+            {
+                opts->decode_thread_type = FF_THREAD_FRAME;
+            }
+            else if (!strcmp(args[i], "slice"))
+            {
+                opts->decode_thread_type = FF_THREAD_SLICE;
+            }
+            else
+            {
+                opts->decode_thread_type = 0;
+            }
+        }
+        else if (!strcmp(args[i], "-low_latency"))
+        {
+            opts->low_latency = 1;
+        }
+        else if (!strcmp(args[i], "-no_framedrop"))
+        {
+            opts->framedrop = 0;
+        }
+        else if (!strcmp(args[i], "-no_frame_pool"))
+        {
+            opts->frame_pool = 0;
+        }
+        else if (!strcmp(args[i], "-batch") && i + 2 < argv)
+        {
+            opts->packet_batch_size = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-max_bytes") && i + 2 < argv)
+        {
+            opts->max_queue_bytes = atoi(args[++i]);
+        }
+        else if (!strcmp(args[i], "-max_secs") && i + 2 < argv)
+        {
+            opts->max_queue_seconds = atof(args[++i]);
+        }
+        else
+        {
+            logw("unknown option %s\n", args[i]);
+        }
+    }
+    return i;
+}
+
 int main(int argv, char **args)
 {
     //设置av_log的level
@@ -552,9 +1354,15 @@ int main(int argv, char **args)
         exit(1);
     }
 
-    input_filename = args[1];
-
     auto *player = new Player();
+    int index = parse_options(&player->options, argv, args);
+    if (index >= argv)
+    {
+        loge("should input play video file path.\n");
+        exit(1);
+    }
+    input_filename = args[index];
+
     player->open(input_filename, NULL);
     delete player;
     std::cout << "play over." << std::endl;
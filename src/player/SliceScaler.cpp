@@ -0,0 +1,220 @@
+#include "SliceScaler.h"
+extern "C"
+{
+#include <libavutil/pixdesc.h>
+#include <libavutil/cpu.h>
+}
+
+SliceScaler::SliceScaler()
+{
+    logi("SliceScaler::SliceScaler()\n");
+}
+
+int SliceScaler::init(int threads, int flags)
+{
+    if (threads <= 0)
+    {
+        threads = av_cpu_count();
+    }
+    nb_threads = av_clip(threads, 1, SCALER_MAX_THREADS);
+    this->flags = flags;
+
+    mutex = SDL_CreateMutex();
+    work_cond = SDL_CreateCond();
+    done_cond = SDL_CreateCond();
+    if (!mutex || !work_cond || !done_cond)
+    {
+        logf("SliceScaler::init SDL_CreateMutex/SDL_CreateCond(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    //slice 0由调用线程转换
+    for (int i = 1; i < nb_threads; i++)
+    {
+        workers[i].scaler = this;
+        workers[i].index = i;
+        tids[i] = SDL_CreateThread(worker_thread, "scale_thread", &workers[i]);
+        if (!tids[i])
+        {
+            logw("SliceScaler::init SDL_CreateThread(): %s, use %d threads\n", SDL_GetError(), i);
+            nb_threads = i;
+            break;
+        }
+    }
+    logi("SliceScaler: %d threads\n", nb_threads);
+    return 0;
+}
+
+int SliceScaler::worker_thread(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    worker->scaler->worker_loop(worker->index);
+    return 0;
+}
+
+void SliceScaler::worker_loop(int index)
+{
+    int64_t seen = 0;
+    SDL_LockMutex(mutex);
+    for (;;)
+    {
+        while (!abort_request && generation == seen)
+        {
+            SDL_CondWait(work_cond, mutex);
+        }
+        if (abort_request)
+        {
+            break;
+        }
+        seen = generation;
+        int has_slice = index < nb_slices;
+        SDL_UnlockMutex(mutex);
+        if (has_slice)
+        {
+            scale_slice(index);
+        }
+        SDL_LockMutex(mutex);
+        if (has_slice && --nb_pending == 0)
+        {
+            SDL_CondSignal(done_cond);
+        }
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+int SliceScaler::configure(int width, int height, enum AVPixelFormat src_format, enum AVPixelFormat dst_format)
+{
+    if (width == this->width && height == this->height && src_format == this->src_format && dst_format == this->dst_format)
+    {
+        return 0;
+    }
+    //图像较小时用更少的slice，每个slice的起始行对齐
+    int n = av_clip(height / SCALER_MIN_SLICE_HEIGHT, 1, nb_threads);
+    int slice_h = FFALIGN((height + n - 1) / n, SCALER_SLICE_ALIGN);
+    int count = 0;
+    for (int y = 0; y < height && count < nb_threads; y += slice_h, count++)
+    {
+        Slice *slice = &slices[count];
+        slice->y = y;
+        slice->h = FFMIN(slice_h, height - y);
+        //每个slice作为一张独立的图像转换，尺寸不变，所以不需要相邻slice的数据
+        slice->ctx = sws_getCachedContext(slice->ctx, width, slice->h, src_format,
+                                          width, slice->h, dst_format, flags, NULL, NULL, NULL);
+        if (!slice->ctx)
+        {
+            loge("SliceScaler: cannot initialize the conversion context for %s -> %s\n",
+                 av_get_pix_fmt_name(src_format), av_get_pix_fmt_name(dst_format));
+            this->width = 0;
+            return AVERROR(EINVAL);
+        }
+    }
+    for (int i = count; i < SCALER_MAX_THREADS; i++)
+    {
+        sws_freeContext(slices[i].ctx);
+        slices[i].ctx = NULL;
+    }
+    nb_slices = count;
+    this->width = width;
+    this->height = height;
+    this->src_format = src_format;
+    this->dst_format = dst_format;
+    logi("SliceScaler: %s -> %s %dx%d, %d slices of %d rows\n", av_get_pix_fmt_name(src_format),
+         av_get_pix_fmt_name(dst_format), width, height, nb_slices, slice_h);
+    return 0;
+}
+
+void SliceScaler::scale_slice(int index)
+{
+    Slice *slice = &slices[index];
+    const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(src_format);
+    const AVPixFmtDescriptor *dst_desc = av_pix_fmt_desc_get(dst_format);
+    const uint8_t *src[4];
+    uint8_t *dst[4];
+    int src_planes = av_pix_fmt_count_planes(src_format);
+    int dst_planes = av_pix_fmt_count_planes(dst_format);
+    //调色板等不是plane的数据不需要偏移
+    for (int p = 0; p < 4; p++)
+    {
+        int shift = (p == 1 || p == 2) ? src_desc->log2_chroma_h : 0;
+        src[p] = p < src_planes ? src_data[p] + (slice->y >> shift) * src_linesize[p] : src_data[p];
+        shift = (p == 1 || p == 2) ? dst_desc->log2_chroma_h : 0;
+        dst[p] = p < dst_planes ? dst_data[p] + (slice->y >> shift) * dst_linesize[p] : dst_data[p];
+    }
+    sws_scale(slice->ctx, src, src_linesize, 0, slice->h, dst, dst_linesize);
+}
+
+int SliceScaler::scale(AVFrame *frame, enum AVPixelFormat dst_format, uint8_t *dst[4], int dst_linesize[4])
+{
+    int ret = configure(frame->width, frame->height, (enum AVPixelFormat)frame->format, dst_format);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    for (int p = 0; p < 4; p++)
+    {
+        src_data[p] = frame->data[p];
+        src_linesize[p] = frame->linesize[p];
+        dst_data[p] = dst[p];
+        this->dst_linesize[p] = dst_linesize[p];
+    }
+    if (nb_slices > 1)
+    {
+        SDL_LockMutex(mutex);
+        nb_pending = nb_slices - 1;
+        generation++;
+        SDL_CondBroadcast(work_cond);
+        SDL_UnlockMutex(mutex);
+    }
+    scale_slice(0);
+    if (nb_slices > 1)
+    {
+        SDL_LockMutex(mutex);
+        while (nb_pending > 0)
+        {
+            SDL_CondWait(done_cond, mutex);
+        }
+        SDL_UnlockMutex(mutex);
+    }
+    return 0;
+}
+
+void SliceScaler::destory()
+{
+    if (mutex)
+    {
+        SDL_LockMutex(mutex);
+        abort_request = 1;
+        SDL_CondBroadcast(work_cond);
+        SDL_UnlockMutex(mutex);
+    }
+    for (int i = 0; i < SCALER_MAX_THREADS; i++)
+    {
+        if (tids[i])
+        {
+            SDL_WaitThread(tids[i], NULL);
+            tids[i] = NULL;
+        }
+        sws_freeContext(slices[i].ctx);
+        slices[i].ctx = NULL;
+    }
+    if (work_cond)
+    {
+        SDL_DestroyCond(work_cond);
+        work_cond = NULL;
+    }
+    if (done_cond)
+    {
+        SDL_DestroyCond(done_cond);
+        done_cond = NULL;
+    }
+    if (mutex)
+    {
+        SDL_DestroyMutex(mutex);
+        mutex = NULL;
+    }
+}
+
+SliceScaler::~SliceScaler()
+{
+    logi("SliceScaler::~SliceScaler()\n");
+    destory();
+}